@@ -10,7 +10,11 @@ kb=8.6173324E-5 # in units of eV
 #pot=0.13*randn(N) # Normal distribution
 #pot=0.13*sin(range(0,N)) # Sinusoidal variations
 
-N,pot = recombination.starrynight_read_potential(ARGS[1])
+if endswith(ARGS[1],".npy") # SaveArrays: true
+    N,pot = recombination.starrynight_read_potential_npy(ARGS[1])
+else
+    N,pot = recombination.starrynight_read_potential(ARGS[1])
+end
 
 function potential_statistics(N,pot)
     println("Boltzmann statistics...")
@@ -18,6 +18,22 @@ function starrynight_read_potential(filename)
     lattice=readdlm(filename)
     pot=lattice[:,4] # just potential, in internal units of Starrynight
 
+    return starrynight_convert_potential(pot)
+end
+
+#Read in potential from *_potential.npy (SaveArrays: true); memory mapped, no parsing
+function starrynight_read_potential_npy(filename)
+    io=open(filename)
+    seek(io,8)
+    offset=10+Int(ltoh(read(io,UInt16))) # NPY 1.0 header length
+    N=div(filesize(filename)-offset,sizeof(Float64))
+    # C order (X,Y,Z); flattened here, as from the text file
+    pot=Mmap.mmap(io,Vector{Float64},N,offset)
+
+    return starrynight_convert_potential(pot)
+end
+
+function starrynight_convert_potential(pot)
     T=300           # Temperature; Kelvin
     β=1/(kb*T)      # Thermodynamic Beta; units
 
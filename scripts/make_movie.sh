@@ -1,3 +1,7 @@
+# With NativePNG: true and PNGScale set in the .cfg, the frames come out of the
+# run as scaled PNGs, and can go straight to mplayer / mencoder:
+#   mplayer -fps 10 mf://T_*_MC-PNG_final.png
+
 for file in MC-PNG_step*.png
 do
     echo -n "."
@@ -10,14 +10,19 @@
 // Prototypes...
 static void lattice_angle_log(FILE *log);
 static double polarisation();
-static double dipole_potential(int x, int y, int z);
 static void recombination_calculator(FILE *log);
-static double dipole_electricfield(int CUTOFF, int x, int y, int z);
+static void recombination_densities(char * filename);
 static void lattice_potential_log(FILE *log);
 void lattice_potential_XY(char * filename);
 void lattice_potential_XYZ(char * filename);
 void lattice_potential_cube(char * filename);
 static double lattice_energy_log(FILE *log);
+static void sample_log(FILE *fo);
+static double polarisation_running();
+static double landau_order_running();
+static void moments_reset();
+static void moments_sample();
+static void moments_log(FILE *fo);
 double landau_order();
 double radial_order_parameter(char * filename);
 
@@ -61,171 +66,291 @@ static double polarisation()
     return(P);
 }
 
-//Calculate dipole potential at specific location
-static double dipole_potential(int x, int y, int z) 
+// O(1) versions of polarisation() and landau_order(), from the running Ptotal
+static double polarisation_running()
 {
-    int dx,dy,dz=0;
-    int MAX=6;
-    double pot=0.0;
-    float d;
-    struct dipole r;
+    return(Ptotal.x/(double)(X*Y*Z));
+}
 
-    for (dx=-MAX;dx<=MAX;dx++)
-        for (dy=-MAX;dy<=MAX;dy++)
-//#if(Z>1) //i.e. 3D in Z // broken by dynamic lattice allocation. FIXME for 2D
-            for (dz=-MAX;dz<=MAX;dz++)
-//#endif
-            {
-                if (dx==0 && dy==0 && dz==0)
-                    continue; //no infinities / self interactions please!
+static double landau_order_running()
+{
+    return((Ptotal.x*Ptotal.x+Ptotal.y*Ptotal.y+Ptotal.z*Ptotal.z) / ((double)(X*Y*Z)*(double)(X*Y*Z)));
+}
+
+// Online moments of the order parameter m=|Ptotal|/N, polarisation P (along
+// x) and energy; sampled once per sweep from the running totals, so O(1).
+// Energies are accumulated relative to the first sample, to keep
+// <E^2>-<E>^2 from cancelling catastrophically.
+struct
+{
+    double n;
+    double P, m, m2, m4;
+    double Eshift, E, E2;
+} moments;
+
+static void moments_reset()
+{
+    moments.n=0.0;
+    moments.P=0.0; moments.m=0.0; moments.m2=0.0; moments.m4=0.0;
+    moments.Eshift=Etotal; moments.E=0.0; moments.E2=0.0;
+}
 
-                r.x=(float)(dx); r.y=(float)(dy); r.z=(float)(dz);
+static void moments_sample()
+{
+    double m2=landau_order_running();
+    double dE=Etotal-moments.Eshift;
+
+    moments.n+=1.0;
+    moments.P+=polarisation_running();
+    moments.m+=sqrt(m2);
+    moments.m2+=m2;
+    moments.m4+=m2*m2;
+    moments.E+=dE;
+    moments.E2+=dE*dE;
+}
 
-                d=sqrt((float) r.x*r.x + r.y*r.y + r.z*r.z); //that old chestnut
+// susceptibility chi = beta N (<m^2>-<m>^2); heat capacity (per site)
+// C = beta^2 (<E^2>-<E>^2) / N; Binder cumulant U = 1 - <m^4>/(3 <m^2>^2)
+static void moments_log(FILE *fo)
+{
+    double n=moments.n;
+    double sites=(double)(X*Y*Z);
+    double m,m2,E,E2;
+
+    if (n==0.0) return;
+    m=moments.m/n; m2=moments.m2/n;
+    E=moments.E/n; E2=moments.E2/n;
+
+    fprintf(fo,"T: %d samples: %.0f <P>: %f <m>: %f <E>: %f chi: %f C: %f U: %f\n",
+            T,n,moments.P/n,m,moments.Eshift+E,
+            beta*sites*(m2-m*m),
+            beta*beta*(E2-E*E)/sites,
+            1.0-(moments.m4/n)/(3.0*m2*m2));
+}
 
-                if (d>(float)MAX) continue; // Cutoff in d
+// Fermi-Dirac occupations e=1/(exp(x)+1) and h=1/(exp(-x)+1), from the one
+// exp(-|x|); no overflow, and the small one never comes from 1-(the other)
+static void fermi_dirac(double x, double *e, double *h)
+{
+    double t=exp(-fabs(x));
 
-                // pot(r) = 1/4PiEpsilon * p.r / r^3
-                // Electric dipole potential
-                pot+=lattice[(X+x+dx)%X][(Y+y+dy)%Y][(Z+z+dz)%Z].length *
-                    dot(& lattice[(X+x+dx)%X][(Y+y+dy)%Y][(Z+z+dz)%Z] ,& r)/(d*d*d);
-            }
-    return(pot);
+    if (x>0.0) { *e=t/(1.0+t); *h=1.0/(1.0+t); }
+    else { *e=1.0/(1.0+t); *h=t/(1.0+t); }
+}
+
+// Running log-sum-exp: (m,s) represent log(s)+m, rescaled as the max rises
+static void logsumexp_add(double *m, double *s, double v)
+{
+    if (v>*m) { *s=*s*exp(*m-v)+1.0; *m=v; }
+    else *s+=exp(v-*m);
+}
+
+static void logsumexp_merge(double *m, double *s, double m2, double s2)
+{
+    if (s2==0.0) return;
+    if (m2>*m) { *s=*s*exp(*m-m2)+s2; *m=m2; }
+    else *s+=s2*exp(m2-*m);
+}
+
+// Partition functions and recombination rate for one (kT, dielectric) pair
+struct recombination_sums
+{
+    double mBe,sBe, mBh,sBh; // Boltzmann, as log-sum-exp
+    double ZFDe,ZFDh; // Fermi-Dirac
+    double FDeh; // sum of electron * hole occupation
+};
+
+static double logsumexp(double m, double s)
+{
+    return(m+log(s));
+}
+
+// R_Boltz = N^2/(ZBe ZBh), in logs as the Zs themselves may overflow
+static double recombination_boltzmann(double lnZBe, double lnZBh)
+{
+    int sites=X*Y*Z;
+    return(exp(2.0*log((double)sites)-lnZBe-lnZBh));
 }
 
 //Funky recombination model
+// One parallel pass over the (cached) potential evaluates every pair of
+// RecombinationkT x RecombinationDielectric at once; densities are never
+// stored, only their sums, so nothing scales with the lattice but phi.
 static void recombination_calculator(FILE *log)
 {
-    double MINPOT=1e6,MAXPOT=-1e6;
-    double pot;
-    double electrons[X][Y][Z],holes[X][Y][Z], recombination[X][Y][Z];
-    double electron_total=0.0, hole_total=0.0, totalrecombination=0.0;
-    int x,y,z;
-
-    double BETA=1/(0.025); // 1/ (k_b T) in eV
+    int i,k,x,y;
+    int sites=X*Y*Z;
+    int pairs=RecombinationkTs*RecombinationDielectrics;
     double potentialeV=0.165; // convert internal units --> eV / V for pot
-    potentialeV/=5; // dielectric constant: screens electrostatic potential
+    double BETA,pot,e,h,lnZBe,lnZBh;
+    struct recombination_sums *sums;
+
+    double *phi=lattice_potential();
 
     // PARTITION FUNCTIONS <<< WHERE THE MAGIC HAPPENS <<<
-    double ZBe=0.0, ZBh=0.0;
-    double ZFDe=0.0, ZFDh=0.0;
+    sums=(struct recombination_sums *)malloc(sizeof(struct recombination_sums)*pairs);
+    for (k=0;k<pairs;k++)
+    {
+        sums[k].mBe=-INFINITY; sums[k].sBe=0.0;
+        sums[k].mBh=-INFINITY; sums[k].sBh=0.0;
+        sums[k].ZFDe=0.0; sums[k].ZFDh=0.0; sums[k].FDeh=0.0;
+    }
 
-    for (x=0;x<X;x++) 
-        for (y=0;y<Y;y++)
-            for (z=0;z<Z;z++)
+#pragma omp parallel private(i,k,pot,e,h)
+    {
+        struct recombination_sums *local=(struct recombination_sums *)malloc(sizeof(struct recombination_sums)*pairs);
+        double scale[pairs]; // BETA*potentialeV/dielectric (a handful; fine on the stack)
+
+        for (k=0;k<pairs;k++)
+        {
+            local[k]=sums[k];
+            scale[k]=potentialeV/RecombinationDielectric[k%RecombinationDielectrics]/RecombinationkT[k/RecombinationDielectrics];
+        }
+
+#pragma omp for
+        for (i=0;i<sites;i++)
+            for (k=0;k<pairs;k++)
             {
-                pot=potentialeV*dipole_potential(x,y,z);
+                pot=scale[k]*phi[i]; // pot*BETA
                 // Boltzmann statistics
-                ZBe+=exp(-pot*BETA);
-                ZBh+=exp(pot*BETA); // holes float...
+                logsumexp_add(&local[k].mBe,&local[k].sBe,-pot);
+                logsumexp_add(&local[k].mBh,&local[k].sBh,pot); // holes float...
 
                 // Fermi-Dirac statistics
                 // NB: sign reversed as 1/exp() c.f. Boltzmann
-                ZFDe+=1.0/(exp(pot*BETA)+1.0);
-                ZFDh+=1.0/(exp(-pot*BETA)+1.0); // holes float...
+                fermi_dirac(pot,&e,&h);
+                local[k].ZFDe+=e;
+                local[k].ZFDh+=h; // holes float...
+                local[k].FDeh+=e*h;
             }
 
+#pragma omp critical
+        for (k=0;k<pairs;k++)
+        {
+            logsumexp_merge(&sums[k].mBe,&sums[k].sBe,local[k].mBe,local[k].sBe);
+            logsumexp_merge(&sums[k].mBh,&sums[k].sBh,local[k].mBh,local[k].sBh);
+            sums[k].ZFDe+=local[k].ZFDe;
+            sums[k].ZFDh+=local[k].ZFDh;
+            sums[k].FDeh+=local[k].FDeh;
+        }
+        free(local);
+    }
+
     // set density = 1 per site on average
     // Thus no distribution in electrostatic potential, recombination=1*1
-//    Ze/=X*Y*Z;
-//    Zh/=X*Y*Z;
+    // R_Boltz = N^2/(ZBe ZBh); R_FD = N sum(e*h), with e,h normalised by their Z
+    for (k=0;k<pairs;k++)
+    {
+        lnZBe=logsumexp(sums[k].mBe,sums[k].sBe);
+        lnZBh=logsumexp(sums[k].mBh,sums[k].sBh);
+        fprintf(log,"T: %d kT: %f Dielectric: %f lnZBe: %e lnZBh: %e ZFDe: %e ZFDh: %e R_Boltz: %e R_FD: %e\n",
+                T,RecombinationkT[k/RecombinationDielectrics],RecombinationDielectric[k%RecombinationDielectrics],
+                lnZBe,lnZBh,sums[k].ZFDe,sums[k].ZFDh,
+                recombination_boltzmann(lnZBe,lnZBh),
+                sites*sums[k].FDeh/(sums[k].ZFDe*sums[k].ZFDh));
+    }
+    fflush(log); //flush output buffer; commits writes to OS / disk.
 
-    fprintf(log,"T: %d ZBe: %e ZBh: %e ZFDe: %e ZFDh: %e R_Boltz: %e ",
-            T,ZBe,ZBh,ZFDe,ZFDh,(X*Y*Z)*(X*Y*Z)/(ZBe*ZBh));
+    // Plot densities holes / e, for the first (kT, dielectric) pair
+    
+    //  EVERYTHING BELOW HERE SHOULD BE OUTPUT; NOT PHYSICS
+    // Densities of the z=0 plane are recomputed from phi, rather than stored
+
+    BETA=1.0/RecombinationkT[0];
+    potentialeV/=RecombinationDielectric[0]; // dielectric constant: screens electrostatic potential
+#define RECOMBINATION_DENSITY(x,y) \
+    pot=potentialeV*phi[((x)*Y+(y))*Z]*BETA; \
+    fermi_dirac(pot,&e,&h); \
+    e/=sums[0].ZFDe; h/=sums[0].ZFDh;
 
     double eMAX=0.0,hMAX=0.0,RMAX=0.0;
+    char line[TEXT_LINE];
+    struct termframe *f;
 
-    // Calculate densities of electrons and holes through the lattice; 
-    // multiply these together for the total recombination
-    for (x=0;x<X;x++) 
+    if (terminal_due(TERM_RECOMBINATION))
+    {
+        for (x=0;x<X;x++)
+            for (y=0;y<Y;y++)
+            {
+                RECOMBINATION_DENSITY(x,y);
+                if (e>eMAX) eMAX=e;
+                if (h>hMAX) hMAX=h;
+                if (e*h>RMAX) RMAX=e*h;
+            }
+
+        // Composed into a frame, drawn at once (see starrynight-terminal.c)
+        // Xterm 256 color map - shades of grey (232..255)
+        // https://code.google.com/p/conemu-maximus5/wiki/AnsiEscapeCodes#xterm_256_color_processing_requirements
+        f=terminal_frame(TERM_RECOMBINATION);
+        sprintf(line,"%*s%*s",X+3, "ELECTRONS", (2*X)+4,"HOLES"); //padded labels
+        terminal_text(f,0,0,line);
+        sprintf(line,"Density eMAX: %f hMAX: %f",eMAX,hMAX);
+        terminal_text(f,1,0,line);
         for (y=0;y<Y;y++)
-            for (z=0;z<Z;z++)
+            for (x=0;x<X;x++)
             {
-                // Fermi dirac distributions from bottom of potential energy
-                // surf
-                pot=potentialeV*dipole_potential(x,y,z);
-                
-                electrons[x][y][z]=1.0/(exp(pot*BETA)+1.0)/ZFDe;
-                holes    [x][y][z]=1.0/(exp(-pot*BETA)+1.0)/ZFDh;
-
-                // Boltzmann
-//                electrons[x][y][z]=exp(-pot*BETA)/ZBe;
-//                holes    [x][y][z]=exp(pot*BETA)/ZBh;
-
-                recombination[x][y][z]=electrons[x][y][z]*holes[x][y][z];
-/*                
-                fprintf(stderr,"x: %d y: %d z: %d pot: %e e: %e h: %e e*h: %e\n",x,y,z,
-                        pot,
-                        electrons[x][y][z],holes[x][y][z],electrons[x][y][z]*holes[x][y][z]);
-*/
-
-                if (electrons[x][y][0]>eMAX) eMAX=electrons[x][y][0];
-                if (holes[x][y][0]>hMAX) hMAX=holes[x][y][0];
-                if (recombination[x][y][0]>RMAX) RMAX=recombination[x][y][0];
-
-                electron_total+=electrons[x][y][z];
-                    hole_total+=holes[x][y][z];
-                totalrecombination+=electrons[x][y][z]*holes[x][y][z];
+                RECOMBINATION_DENSITY(x,y);
+                terminal_cell(f,2+y,2*x,(int)(10.0/eMAX*e)+'0',0,false,232+(int)(23.0/eMAX*e));
+                terminal_cell(f,2+y,2*x+1,'.',0,false,232+(int)(23.0/eMAX*e));
+                terminal_cell(f,2+y,2*X+4+2*x,(int)(10.0/hMAX*h)+'0',0,false,232+(int)(23.0/hMAX*h));
+                terminal_cell(f,2+y,2*X+4+2*x+1,'.',0,false,232+(int)(23.0/hMAX*h));
             }
 
-    fprintf(log,"R_FD: %e FD-Total-electron: %e FD-Total-hole: %e\n",
-            X*Y*Z*totalrecombination,electron_total,hole_total);
-    fflush(log); //flush output buffer; commits writes to OS / disk.
+        sprintf(line,"RMAX: %e",RMAX);
+        terminal_text(f,Y+2,0,line);
+        sprintf(line,"%*s",2+X+X+X, "<<< RECOMBINATION <<<");
+        terminal_text(f,Y+3,0,line);
+        for (y=0;y<Y;y++)
+            for (x=0;x<X;x++)
+            {
+                RECOMBINATION_DENSITY(x,y);
+                terminal_cell(f,Y+4+y,2+X+2*x,(int)(10.0*e*h/RMAX)+'0',0,false,232+(int)(23.0*e*h/RMAX));
+                terminal_cell(f,Y+4+y,2+X+2*x+1,'.',0,false,232+(int)(23.0*e*h/RMAX));
+            }
+        terminal_draw(f,TERM_RECOMBINATION);
+    }
+#undef RECOMBINATION_DENSITY
 
-    // Plot densities holes / e
-    
-    //  EVERYTHING BELOW HERE SHOULD BE OUTPUT; NOT PHYSICS
+    // echo recombination rate to stderr to go below e-/h+ densities
+    lnZBe=logsumexp(sums[0].mBe,sums[0].sBe);
+    lnZBh=logsumexp(sums[0].mBh,sums[0].sBh);
+    fprintf(stderr,"T: %d kT: %f Dielectric: %f lnZBe: %e lnZBh: %e ZFDe: %e ZFDh: %e R_Boltz: %e R_FD: %e\n",
+            T,RecombinationkT[0],RecombinationDielectric[0],lnZBe,lnZBh,sums[0].ZFDe,sums[0].ZFDh,
+            recombination_boltzmann(lnZBe,lnZBh),
+            sites*sums[0].FDeh/(sums[0].ZFDe*sums[0].ZFDh));
+
+    free(sums);
+}
 
-    const char * density="012345689";
-//    fprintf(stderr,"    ");
-//    float DMAX=1.0/(X*Y*Z);
-    fprintf(stderr,"%*s%*s\n",X+3, "ELECTRONS", (2*X)+4,"HOLES"); //padded labels
-    fprintf(stderr,"Density eMAX: %f hMAX: %f\n",eMAX,hMAX);
-    for (y=0;y<Y;y++)
+// Electron and hole densities over the whole lattice, for the first (kT,
+// dielectric) pair, as an array file (see starrynight-arrays.c)
+static void recombination_densities(char * filename)
+{
+    int i;
+    int sites=X*Y*Z;
+    double scale=0.165/RecombinationDielectric[0]/RecombinationkT[0]; // as recombination_calculator()
+    double Ze=0.0,Zh=0.0;
+    double *phi=lattice_potential();
+    double *rho=(double *)malloc(sizeof(double)*2*sites); // electrons, then holes
+    int shape[4]={2,X,Y,Z};
+    struct iovec iov={rho,sizeof(double)*2*sites};
+
+#pragma omp parallel for reduction(+:Ze,Zh)
+    for (i=0;i<sites;i++)
     {
-        for (x=0;x<X;x++)
-        {
-
-            int greycode=(int)(23.0/eMAX*electrons[x][y][0]);
-            fprintf(stderr,"%c[48;5;%d",27,232+greycode); // Xterm 256 color map - shades of grey (232..255)
-            // https://code.google.com/p/conemu-maximus5/wiki/AnsiEscapeCodes#xterm_256_color_processing_requirements
-            greycode=(int)(10.0/eMAX*electrons[x][y][0]);
-            fprintf(stderr,"m%c%c%c[0m",greycode+'0','.',27);
-        }
-        fprintf(stderr,"    ");
-        for (x=0;x<X;x++)
-        {
-
-            int greycode=(int)(23.0/hMAX*holes[x][y][0]);
-            fprintf(stderr,"%c[48;5;%d",27,232+greycode); // Xterm 256 color map - shades of grey (232..255)
-            // https://code.google.com/p/conemu-maximus5/wiki/AnsiEscapeCodes#xterm_256_color_processing_requirements
-            greycode=(int)(10.0/hMAX*holes[x][y][0]);
-            fprintf(stderr,"m%c%c%c[0m",greycode+'0','.',27);
-        }
-        fprintf(stderr,"\n");
+        fermi_dirac(scale*phi[i],&rho[i],&rho[sites+i]);
+        Ze+=rho[i];
+        Zh+=rho[sites+i];
     }
-
-    fprintf(stderr,"RMAX: %e\n",RMAX);
-    fprintf(stderr,"%*s\n",2+X+X+X, "<<< RECOMBINATION <<<");
-    for (y=0;y<Y;y++)
+#pragma omp parallel for
+    for (i=0;i<sites;i++)
     {
-        fprintf(stderr,"%*s",2+X," ");
-        for (x=0;x<X;x++)
-        {
-            int greycode=(int)(23.0*recombination[x][y][0]/RMAX);
-            fprintf(stderr,"%c[48;5;%d",27,232+greycode); 
-            greycode=(int)(10.0*recombination[x][y][0]/RMAX);
-            fprintf(stderr,"m%c%c%c[0m",greycode+'0','.',27);
-//        fprintf(stderr,"%e ",recombination[x][y][0]/RMAX);
-        }
-        fprintf(stderr,"\n");
+        rho[i]/=Ze;
+        rho[sites+i]/=Zh;
     }
 
-    // echo recombination rate to stderr to go below e-/h+ densities
-    fprintf(stderr,"T: %d ZBe: %e ZBh: %e ZFDe: %e ZFDh: %e R_Boltz: %e \n",
-            T,ZBe,ZBh,ZFDe,ZFDh,(X*Y*Z)*(X*Y*Z)/(ZBe*ZBh));
-    fprintf(stderr,"R_FD: %e FD-Total-electron: %e FD-Total-hole: %e\n",
-            X*Y*Z*totalrecombination,electron_total,hole_total);
+    array_write(filename,'f',sizeof(double),4,shape,&iov,1,"electron, hole densities");
+    free(rho);
 }
 
 //Calculates dipole potential along trace of lattice
@@ -233,6 +358,7 @@ static void lattice_potential_log(FILE *log)
 {
     int x,y,z;
     double pot;
+    double *phi=lattice_potential();
 
     y=Y/2; //trace across centre of material. I know, I know, PBCs.
     z=0;
@@ -240,47 +366,97 @@ static void lattice_potential_log(FILE *log)
     {
         pot=0.0;
         for (y=0;y<Y;y++)
-            pot+=dipole_potential(x,y,z);
-        fprintf(log,"%d %f %f\n",x,pot/(double)Y,dipole_potential(x,Y/2,z));
+            pot+=phi[(x*Y+y)*Z+z];
+        fprintf(log,"%d %f %f\n",x,pot/(double)Y,phi[(x*Y+Y/2)*Z+z]);
     }
 
 }
 
+// Text output by slabs of x, formatted in parallel; see starrynight-textout.c
+
+// "%d %d %f\n" x y value, of the z=0 plane of field arg
+static void field_XY_slab(struct textbuffer *b, int x, void *arg)
+{
+    double *v=(double *)arg;
+    int y;
+    char *q;
+
+    for (y=0;y<Y;y++)
+    {
+        q=text_reserve(b,TEXT_LINE);
+        q=text_int(q,x); *q++=' ';
+        q=text_int(q,y); *q++=' ';
+        q=text_fixed(q,v[(x*Y+y)*Z+0],6); *q++='\n';
+        b->n=q-b->p;
+    }
+}
+
+// "%d %d %d %f\n" x y z value, of field arg
+static void field_XYZ_slab(struct textbuffer *b, int x, void *arg)
+{
+    double *v=(double *)arg;
+    int y,z;
+    char *q;
+
+    for (y=0;y<Y;y++)
+        for (z=0;z<Z;z++)
+        {
+            q=text_reserve(b,TEXT_LINE);
+            q=text_int(q,x); *q++=' ';
+            q=text_int(q,y); *q++=' ';
+            q=text_int(q,z); *q++=' ';
+            q=text_fixed(q,v[(x*Y+y)*Z+z],6); *q++='\n';
+            b->n=q-b->p;
+        }
+}
+
 //Calculates dipole potential across XY lattice
 void lattice_potential_XY(char * filename)
 {
-    int x,y;
-    double pot;
+    double *phi=lattice_potential();
     FILE *fo;
     fo=fopen(filename,"w");
 
-    for (x=0;x<X;x++)
-        for (y=0;y<Y;y++)
-            fprintf(fo,"%d %d %f\n",x,y,dipole_potential(x,y,0));
+    text_slabs(fo,X,field_XY_slab,phi);
     fclose(fo);
 }
 
 //Calculates dipole potential across XYZ volume
 void lattice_potential_XYZ(char * filename)
 {
-    int x,y,z;
-    double pot;
+    double *phi=lattice_potential();
     FILE *fo;
     fo=fopen(filename,"w");
 
-    for (x=0;x<X;x++)
-        for (y=0;y<Y;y++)
-            for (z=0;z<Z;z++)
-                fprintf(fo,"%d %d %d %f\n",x,y,z,dipole_potential(x,y,z));
+    text_slabs(fo,X,field_XYZ_slab,phi);
     fclose(fo);
 }
 
+// Cube volumetric data, six values a line, each (x,y) row on new lines
+static void cube_slab(struct textbuffer *b, int x, void *arg)
+{
+    double *v=(double *)arg;
+    int y,z;
+    char *q;
+
+    for (y=0;y<Y;y++)
+    {
+        q=text_reserve(b,TEXT_LINE+16*Z);
+        for (z=0;z<Z;z++)
+        {
+            *q++=' ';
+            q=text_exp(q,v[(x*Y+y)*Z+z],5);
+            if (z%6==5 || z==Z-1) *q++='\n';
+        }
+        b->n=q-b->p;
+    }
+}
+
 //Output lattice potential, cube file
 // Spec from http://paulbourke.net/dataformats/cube/
 void lattice_potential_cube(char * filename)
 {
-    int x,y,z;
-    double pot;
+    double *phi=lattice_potential();
     FILE *fo;
     fo=fopen(filename,"w");
 
@@ -293,213 +469,108 @@ void lattice_potential_cube(char * filename)
     // no atoms
 
     // volumetric data
-    for (x=0;x<X;x++)
-        for (y=0;y<Y;y++)
-        {
-            for (z=0;z<Z;z++)
-            {
-                fprintf(fo,"%g ",dipole_potential(x,y,z));
-                if (z%6==5) fprintf(fo,"\n");
-            }
-        fprintf(fo,"\n");
-        }
+    text_slabs(fo,X,cube_slab,phi);
     fclose(fo);
 
 }
 
-static double dipole_electricfieldoffset(int CUTOFF, int x, int y, int z)
+// "%d %d %d %f\n" x y z |E|, of struct field arg
+static void field_magnitude_XYZ_slab(struct textbuffer *b, int x, void *arg)
 {
-    int dx,dy,dz=0;
-    
-    struct dipole Efield={0.0, 0.0, 0.0};
-    struct dipole Efieldcontribution={0.0, 0.0, 0.0};
-    struct dipole r,n;
-
-    float d;
-    double radial;
-
-    for (dx=-CUTOFF-1;dx<CUTOFF;dx++)
-        for (dy=-CUTOFF-1;dy<CUTOFF;dy++)
-//#if(Z>1) //i.e. 3D in Z // broken by dynamic lattice allocation. FIXME FOR 2D!
-            for (dz=-CUTOFF-1;dz<CUTOFF;dz++)
-//#endif
-            {
-//                if (dx==0 && dy==0 && dz==0)
-//                    continue; //no infinities / self interactions please!
-
-                r.x=(float)(dx)+0.5; r.y=(float)(dy)+0.5; r.z=(float)(dz)+0.5;
-
-                d=sqrt((float) r.x*r.x + r.y*r.y + r.z*r.z); //that old chestnut
-
-                if (d>(float)CUTOFF) continue; // Cutoff in d
-
-                // I am so SORRY about what follows; C is not the ideal
-                // language for maths.
-                // We are just calculating the dipole electric field by:
-                // E = ( 1/4PiEpsilon ) * 
-
-                // n = r / d; normalised displacement vector
-                n.x=r.x/d; n.y=r.y/d; n.z=r.z/d;
-
-                // Scalar radial = n.p
-                radial=dot(&n,& lattice[(X+x+dx)%X][(Y+y+dy)%Y][(Z+z+dz)%Z]);
-                
-                // Vector 3*n*radial - p
-                Efieldcontribution.x=3*n.x*radial - lattice[(X+x+dx)%X][(Y+y+dy)%Y][(Z+z+dz)%Z].x;
-                Efieldcontribution.y=3*n.y*radial - lattice[(X+x+dx)%X][(Y+y+dy)%Y][(Z+z+dz)%Z].y;
-                Efieldcontribution.z=3*n.z*radial - lattice[(X+x+dx)%X][(Y+y+dy)%Y][(Z+z+dz)%Z].z;
-
-                // Divide top half of expression by denominator (d^3)
-                Efieldcontribution.x/=d*d*d;
-                Efieldcontribution.y/=d*d*d;
-                Efieldcontribution.z/=d*d*d;
-
-                // Vector addition of contribution into count
-                Efield.x+=Efieldcontribution.x;
-                Efield.y+=Efieldcontribution.y;
-                Efield.z+=Efieldcontribution.z;
-
-                fprintf(stderr,"Efieldcontribution: r= %f %f %f Efield= %f %f %f mag: %f\n",
-                        r.x, r.y, r.z,
-                        Efieldcontribution.x,Efieldcontribution.y,Efieldcontribution.z,sqrt(dot(&Efieldcontribution,&Efieldcontribution)));
-            }
+    struct field *E=(struct field *)arg;
+    int y,z,i;
+    char *q;
 
-    Efieldcontribution.x/=4*M_PI;
-    Efieldcontribution.y/=4*M_PI;
-    Efieldcontribution.z/=4*M_PI;
-
-    fprintf(stderr,"\nEfield: %f %f %f mag: %f\n\n",
-            Efield.x,Efield.y,Efield.z,sqrt(dot(&Efield,&Efield)));
- 
-    return (sqrt(dot(&Efield,&Efield))); // for now return magnitude
+    for (y=0;y<Y;y++)
+        for (z=0;z<Z;z++)
+        {
+            i=(x*Y+y)*Z+z;
+            q=text_reserve(b,TEXT_LINE);
+            q=text_int(q,x); *q++=' ';
+            q=text_int(q,y); *q++=' ';
+            q=text_int(q,z); *q++=' ';
+            q=text_fixed(q,sqrt(E->x[i]*E->x[i]+E->y[i]*E->y[i]+E->z[i]*E->z[i]),6); *q++='\n';
+            b->n=q-b->p;
+        }
 }
 
-
 //Calculates dipole potential across XYZ volume
 void lattice_Efieldoffset_XYZ(char * filename)
 {
-    int x,y,z;
     FILE *fo;
     fo=fopen(filename,"w");
 
-    for (x=0;x<X;x++)
-        for (y=0;y<Y;y++)
-            for (z=0;z<Z;z++)
-                fprintf(fo,"%d %d %d %f\n",x,y,z,dipole_electricfieldoffset(2,x,y,z));
+    lattice_efield();
+
+    text_slabs(fo,X,field_magnitude_XYZ_slab,&efield_offset);
     fclose(fo);
 }
 
 
-static double dipole_electricfield(int CUTOFF, int x, int y, int z)
+//Calculates dipole potential across XYZ volume
+void lattice_Efield_XYZ(char * filename)
 {
-    int dx,dy,dz=0;
-    
-    struct dipole Efield={0.0, 0.0, 0.0};
-    struct dipole Efieldcontribution={0.0, 0.0, 0.0};
-    struct dipole r,n;
-
-    float d;
-    double radial;
-
-    for (dx=-CUTOFF;dx<=CUTOFF;dx++)
-        for (dy=-CUTOFF;dy<=CUTOFF;dy++)
-//#if(Z>1) //i.e. 3D in Z // apparently broken by dynamic allocation of lattice.
-            for (dz=-CUTOFF;dz<=CUTOFF;dz++)
-//#endif
-            {
-                if (dx==0 && dy==0 && dz==0)
-                    continue; //no infinities / self interactions please!
-
-                r.x=(float)(dx); r.y=(float)(dy); r.z=(float)(dz);
-
-                d=sqrt((float) r.x*r.x + r.y*r.y + r.z*r.z); //that old chestnut
-
-                if (d>(float)CUTOFF) continue; // Cutoff in d
-
-                // I am so SORRY about what follows; C is not the ideal
-                // language for maths.
-                // We are just calculating the dipole electric field by:
-                // E = ( 1/4PiEpsilon ) * 
-
-                // n = r / d; normalised displacement vector
-                n.x=r.x/d; n.y=r.y/d; n.z=r.z/d;
-
-                // Scalar radial = n.p
-                radial=dot(&n,& lattice[(X+x+dx)%X][(Y+y+dy)%Y][(Z+z+dz)%Z]);
-                
-                // Vector 3*n*radial - p
-                Efieldcontribution.x=3*n.x*radial - lattice[(X+x+dx)%X][(Y+y+dy)%Y][(Z+z+dz)%Z].x;
-                Efieldcontribution.y=3*n.y*radial - lattice[(X+x+dx)%X][(Y+y+dy)%Y][(Z+z+dz)%Z].y;
-                Efieldcontribution.z=3*n.z*radial - lattice[(X+x+dx)%X][(Y+y+dy)%Y][(Z+z+dz)%Z].z;
-
-                // Divide top half of expression by denominator (d^3)
-                Efieldcontribution.x/=d*d*d;
-                Efieldcontribution.y/=d*d*d;
-                Efieldcontribution.z/=d*d*d;
-
-                // Vector addition of contribution into count
-                Efield.x+=Efieldcontribution.x;
-                Efield.y+=Efieldcontribution.y;
-                Efield.z+=Efieldcontribution.z;
+    FILE *fo;
+    fo=fopen(filename,"w");
 
-/*                fprintf(stderr,"Efieldcontribution: r= %d %d %d Efield= %f %f %f mag: %f\n",
-                        dx,dy,dz,
-                        Efieldcontribution.x,Efieldcontribution.y,Efieldcontribution.z,sqrt(dot(&Efieldcontribution,&Efieldcontribution)));
-            */
-            }
+    lattice_efield();
 
-    Efieldcontribution.x/=4*M_PI;
-    Efieldcontribution.y/=4*M_PI;
-    Efieldcontribution.z/=4*M_PI;
+    text_slabs(fo,X,field_magnitude_XYZ_slab,&efield_site);
+    fclose(fo);
+}
 
-    // Kronecker delta contribution from dipole at distance=0
-    Efield.x-= 1/3.0 * lattice[x][y][z].x;
-    Efield.y-= 1/3.0 * lattice[x][y][z].y;
-    Efield.z-= 1/3.0 * lattice[x][y][z].z;
+// Grey level (0..SHRT_MAX) of the potential picture at x=i, y=k, in plane z
+static int potential_pixel(double *phi, int i, int k, int z)
+{
+    int pixel=SHRT_MAX/2+(int)(SHRT_MAX*0.1*phi[(i*Y+k)*Z+z]);
 
-/*    fprintf(stderr,"\nEfield: %f %f %f mag: %f\n\n",
-            Efield.x,Efield.y,Efield.z,sqrt(dot(&Efield,&Efield)));
- */
-    return (sqrt(dot(&Efield,&Efield))); // for now return magnitude
+    // Bounds checking :^)
+    if (pixel<0) pixel=0;
+    if (pixel>SHRT_MAX) pixel=SHRT_MAX;
+    return(pixel);
 }
 
-
-//Calculates dipole potential across XYZ volume
-void lattice_Efield_XYZ(char * filename)
+// A row of the P2 (PGM) potential picture, of field arg
+static void potential_pgm_slab(struct textbuffer *b, int i, void *arg)
 {
-    int x,y,z;
-    FILE *fo;
-    fo=fopen(filename,"w");
+    double *phi=(double *)arg;
+    int k;
+    char *q=text_reserve(b,8*Y+1);
 
-    for (x=0;x<X;x++)
-        for (y=0;y<Y;y++)
-            for (z=0;z<Z;z++)
-                fprintf(fo,"%d %d %d %f\n",x,y,z,dipole_electricfield(4,x,y,z));
-    fclose(fo);
+    for (k=0;k<Y;k++)
+    {
+        q=text_int(q,potential_pixel(phi,i,k,0)); *q++=' ';
+    }
+    *q++='\n';
+    b->n=q-b->p;
 }
 
+// z=0 plane of the potential, as a 16 bit greyscale PNG; else (!NativePNG)
+// the ASCII PGM it has always been
 void outputpotential_png(char * filename)
 {
-    int i,k,pixel;
+    double *phi=lattice_potential();
+    uint16_t *grey;
+    int i,k;
     FILE *fo;
-    fo=fopen(filename,"w");
-
-    fprintf (fo,"P2\n%d %d\n%d\n", X, Y, SHRT_MAX);
 
-    for (i=0;i<X;i++)
+    if (NativePNG)
     {
-        for (k=0;k<Y;k++)
-        {
-            pixel=SHRT_MAX/2+(int)(SHRT_MAX*0.1*dipole_potential(i,k,0));
+        grey=(uint16_t *)malloc(sizeof(uint16_t)*X*Y);
+#pragma omp parallel for private(k)
+        for (i=0;i<X;i++)
+            for (k=0;k<Y;k++)
+                grey[i*Y+k]=2*potential_pixel(phi,i,k,0); // full 16 bit range
+        png_write(filename,(unsigned char *)grey,Y,X,1,16);
+        free(grey);
+        return;
+    }
 
-            // Bounds checking :^)
-            if (pixel<0) pixel=0;
-            if (pixel>SHRT_MAX) pixel=SHRT_MAX;
+    fo=fopen(filename,"w");
 
-            fprintf(fo,"%d ",pixel);
-        }
-        fprintf(fo,"\n");
-    }
+    fprintf (fo,"P2\n%d %d\n%d\n", X, Y, SHRT_MAX);
+
+    text_slabs(fo,X,potential_pgm_slab,phi);
     fclose(fo);
 }
 
@@ -520,63 +591,65 @@ double landau_order()
                 orientation.z+=lattice[x][y][z].z;
             }
 
-    landau=dot(&orientation,&orientation) / (double)(X*Y*Z)*(double)(X*Y*Z); // u.u = |u|^2, 
+    landau=dot(&orientation,&orientation) / ((double)(X*Y*Z)*(double)(X*Y*Z)); // u.u = |u|^2, 
     // so need to divide by N*N to put Landau parameter on range [0;1]
     return(landau);
 }
 
+// One line of the (E, P, Landau) sample stream read by starrynight-wham
+static void sample_log(FILE *fo)
+{
+    fprintf(fo,"%llu %.10g %.10g %.10g\n",(unsigned long long)(ACCEPT+REJECT),Etotal,polarisation_running(),landau_order_running());
+}
+
+// Orientational correlation functions, binned by r^2 out to (not including)
+// RadialCutOff^2. Lattice sums over sites come from the FFT correlation engine,
+// so this is O(N log N + RadialCutOff^3) rather than O(N * RadialCutOff^3).
 double radial_order_parameter(char * filename)
 {
-    int x,y,z;
     int dx,dy,dz;
-    int i;
+    int i,j;
+    int sites=X*Y*Z;
 
     int distance_squared;
-    float FE_correlation,AFE_correlation;
- 
+    double FE_correlation,AFE_correlation;
+
     FILE *fo;
     fo=fopen(filename,"a"); // Open in append mode. If filename doesn't exist, it is created.
 
-    const int CUTOFF=9;
+    const int CUTOFF=RadialCutOff;
+    struct sphere *s=sphere_stencil(CUTOFF,STENCIL_SITE); // r=0 (entry 0) included
 
-    struct dipole n;
-    float d;
+    lattice_correlation(); // symmetrised C_ab(r)+C_ba(r), read by correlation_at()
 
     // define data structures to keep histogram counts in
-    float orientational_FE_correlation[(CUTOFF*CUTOFF)+1];
-    float orientational_AFE_correlation[(CUTOFF*CUTOFF)+1];
-    int orientational_count[(CUTOFF*CUTOFF)+1];
-    for (i=0;i<CUTOFF*CUTOFF;i++) // Zero histogram arrays
-        { orientational_FE_correlation[i]=0.0; orientational_AFE_correlation[i]=0.0; orientational_count[i]=0; }
+    double *orientational_FE_correlation=(double *)calloc(CUTOFF*CUTOFF,sizeof(double));
+    double *orientational_AFE_correlation=(double *)calloc(CUTOFF*CUTOFF,sizeof(double));
+    long long *orientational_count=(long long *)calloc(CUTOFF*CUTOFF,sizeof(long long));
 
-    for (x=0;x<X;x++)
-        for (y=0;y<Y;y++)
-            for (z=0;z<Z;z++)
-                for (dx=-CUTOFF;dx<=CUTOFF;dx++)
-                    for (dy=-CUTOFF;dy<=CUTOFF;dy++)
-                       for (dz=-CUTOFF;dz<=CUTOFF;dz++)
-                        {
-//                            dz=0;
-                            distance_squared=dx*dx + dy*dy + dz*dz; 
-                            if (distance_squared>CUTOFF*CUTOFF) continue; // skip ones that exceed spherical limit of CUTOFF
-
-                            // Ferroelectric Correlation - a simple dot product
-                            FE_correlation=dot(& lattice[x][y][z],
-                                & lattice[(x+dx+X)%X][(y+dy+Y)%Y][(z+dz+Z)%Z]); //complicated modulus arithmatic deals with PBCs
-
-                            // Anti-ferroelectric correlation - Dipole like,
-                            // for a fully AFE ^v^v^v alignment, should give
-                            // you 100% correlation
-                            d=sqrt((float) dx*dx + dy*dy + dz*dz);
-                            if(d==0) d=1; // fudge to stop NaN when n-->zero vector
-                            n.x=(float)dx/d; n.y=(float)dy/d; n.z=(float)dz/d; //normalised diff. vector
-                            AFE_correlation=FE_correlation-3*dot(&n,& lattice[x][y][z])*dot(&n,& lattice[(x+dx+X)%X][(y+dy+Y)%Y][(z+dz+Z)%Z]);
-
-                            // OK; save into histogram
-                            orientational_FE_correlation[distance_squared]+=FE_correlation;
-                            orientational_AFE_correlation[distance_squared]+=AFE_correlation;
-                            orientational_count[distance_squared]++;
-                        }
+    for (j=0;j<s->n;j++)
+    {
+        distance_squared=s->shell[j];
+        if (distance_squared>=CUTOFF*CUTOFF) continue; // skip ones that exceed spherical limit of CUTOFF
+        dx=s->dx[j]; dy=s->dy[j]; dz=s->dz[j];
+
+        // Ferroelectric Correlation - sum over sites of p(x).p(x+r)
+        FE_correlation=0.5*(correlation_at(CXX,dx,dy,dz)+correlation_at(CYY,dx,dy,dz)+correlation_at(CZZ,dx,dy,dz));
+
+        // Anti-ferroelectric correlation - Dipole like,
+        // for a fully AFE ^v^v^v alignment, should give
+        // you 100% correlation
+        //   p(x).p(x+r) - 3 (n.p(x)) (n.p(x+r))
+        // n (normalised diff. vector) is zero at r=0
+        AFE_correlation=FE_correlation-3*(
+                0.5*(s->nx[j]*s->nx[j]*correlation_at(CXX,dx,dy,dz) + s->ny[j]*s->ny[j]*correlation_at(CYY,dx,dy,dz) + s->nz[j]*s->nz[j]*correlation_at(CZZ,dx,dy,dz))
+                + s->nx[j]*s->ny[j]*correlation_at(CXY,dx,dy,dz) + s->nx[j]*s->nz[j]*correlation_at(CXZ,dx,dy,dz) + s->ny[j]*s->nz[j]*correlation_at(CYZ,dx,dy,dz) );
+
+        // OK; save into histogram; every site contributes one pair
+        orientational_FE_correlation[distance_squared]+=FE_correlation;
+        orientational_AFE_correlation[distance_squared]+=AFE_correlation;
+        orientational_count[distance_squared]+=sites;
+    }
 
     // Weight counts into a RDF
     fprintf(fo,"# r^2 r orientational_FE_correlation[r^2] orientational_AFE_correlation[r^2] orientational_count[r^2] T\n");
@@ -584,89 +657,124 @@ double radial_order_parameter(char * filename)
     {   
         if (orientational_count[i]>0)
         {
-            orientational_FE_correlation[i]/=(float)orientational_count[i];
-            orientational_AFE_correlation[i]/=(float)orientational_count[i]; // Currently this really doesn't add anything... Not a very good metric?
-            fprintf(fo,"%d %f %f %f %d %d\n",i,sqrt(i),
+            orientational_FE_correlation[i]/=(double)orientational_count[i];
+            orientational_AFE_correlation[i]/=(double)orientational_count[i]; // Currently this really doesn't add anything... Not a very good metric?
+            fprintf(fo,"%d %f %f %f %lld %d\n",i,sqrt(i),
                     orientational_FE_correlation[i],orientational_AFE_correlation[i],orientational_count[i],T);
         }
     }
     fprintf(fo,"\n"); //starts as new dataset in GNUPLOT --> discontinuous lines
    
     fclose(fo); // CLOSE FILE
+    free(orientational_FE_correlation); free(orientational_AFE_correlation); free(orientational_count);
 
     return(0.0); //Ummm
 }
 
 // TODO: move these output routines to a separate file...
 
+static void lattice_pgm_slab(struct textbuffer *b, int i, void *arg)
+{
+    int k;
+    char *q=text_reserve(b,8*Y+1);
+
+    for (k=0;k<Y;k++)
+    {
+        q=text_int(q,(int)(SHRT_MAX*atan2(lattice[i][k][0].y,lattice[i][k][0].x)/(2*M_PI)));
+        *q++=' ';
+    }
+    *q++='\n';
+    b->n=q-b->p;
+}
+
 void outputlattice_png(char * filename)
 {
-    int i,k;
     FILE *fo;
     fo=fopen(filename,"w");
 
     fprintf (fo,"P2\n%d %d\n%d\n", X, Y, SHRT_MAX);
 
-    for (i=0;i<X;i++)
-    {
-        for (k=0;k<Y;k++)
-            fprintf(fo,"%d ",(int)(SHRT_MAX*atan2(lattice[i][k][0].y,lattice[i][k][0].x)/(2*M_PI)));
-        fprintf(fo,"\n");
-    }
+    text_slabs(fo,X,lattice_pgm_slab,NULL);
     fclose(fo);
 }
 
-// Outputs a PPM bitmap of lattice dipole orientation on a HSV colourwheel
-void outputlattice_ppm_hsv(char * filename)
+// Row x=i, plane z, of the HSV colourwheel picture below, as RGB bytes
+static void lattice_hsv_row(unsigned char *pixel, int i, int z)
 {
-    int i,k;
-    float angle;
+    int k;
 
     float r,g,b; // RGB
     float h,s,v; // HSV
     float p,t,q,f; // intemediates for HSV->RGB conversion
     int hp;
 
-    FILE *fo;
-    fo=fopen(filename,"w");
-
     //Set Saturation + Value, vary hue
     s=0.6; v=0.8;
 
-    fprintf (fo,"P6\n%d %d\n255\n", X, Y);
+    for (k=0;k<Y;k++)
+    {
+        h=M_PI+atan2(lattice[i][k][z].y,lattice[i][k][z].x); //Nb: assumes 0->2PI interval!
+        v=0.5+0.4*lattice[i][k][z].z; //darken towards the south (-z) pole
+        s=0.6-0.6*fabs(lattice[i][k][z].z); //desaturate towards the poles
+
+        // http://en.wikipedia.org/wiki/HSL_and_HSV#From_HSV
+        hp=(int)floor(h/(M_PI/3.0)); //radians, woo
+        f=h/(M_PI/3.0)-(float)hp;
+
+        p=v*(1.0-s);
+        q=v*(1.0-f*s);
+        t=v*(1.0-(1.0-f)*s);
+
+        switch (hp){
+            case 0: r=v; g=t; b=p; break;
+            case 1: r=q; g=v; b=p; break;
+            case 2: r=p; g=v; b=t; break;
+            case 3: r=p; g=q; b=v; break;
+            case 4: r=t; g=p; b=v; break;
+            case 5: r=v; g=p; b=q; break;
+        }
 
-    for (i=0;i<X;i++) //force same ordering as SVG...
-        for (k=0;k<Y;k++)
-        {
-            h=M_PI+atan2(lattice[i][k][0].y,lattice[i][k][0].x); //Nb: assumes 0->2PI interval!
-            v=0.5+0.4*lattice[i][k][0].z; //darken towards the south (-z) pole
-            s=0.6-0.6*fabs(lattice[i][k][0].z); //desaturate towards the poles
-
-            // http://en.wikipedia.org/wiki/HSL_and_HSV#From_HSV
-            hp=(int)floor(h/(M_PI/3.0)); //radians, woo
-            f=h/(M_PI/3.0)-(float)hp;
-
-            p=v*(1.0-s);
-            q=v*(1.0-f*s);
-            t=v*(1.0-(1.0-f)*s);
-
-            switch (hp){
-                case 0: r=v; g=t; b=p; break;
-                case 1: r=q; g=v; b=p; break;
-                case 2: r=p; g=v; b=t; break;
-                case 3: r=p; g=q; b=v; break;
-                case 4: r=t; g=p; b=v; break;
-                case 5: r=v; g=p; b=q; break;
-            }
+        //            fprintf(stderr,"h: %f r: %f g: %f b: %f\n",h,r,g,b);
 
-            //            fprintf(stderr,"h: %f r: %f g: %f b: %f\n",h,r,g,b);
+        if (lattice[i][k][z].x == 0.0 && lattice[i][k][z].y == 0.0 && lattice[i][k][z].z == 0.0)
+        { r=0.0; g=0.0; b=0.0; } // #FADE TO BLACK
+        //zero length dipoles, i.e. absent ones - appear as black pixels
 
-            if (lattice[i][k][0].x == 0.0 && lattice[i][k][0].y == 0.0 && lattice[i][k][0].z == 0.0)
-            { r=0.0; g=0.0; b=0.0; } // #FADE TO BLACK
-            //zero length dipoles, i.e. absent ones - appear as black pixels
+        *pixel++=(char)(254.0*r); *pixel++=(char)(254.0*g); *pixel++=(char)(254.0*b);
+    }
+}
 
-            fprintf(fo,"%c%c%c",(char)(254.0*r),(char)(254.0*g),(char)(254.0*b));
-        }
+// A row of the PPM; binary RGB
+static void lattice_ppm_hsv_slab(struct textbuffer *buffer, int i, void *arg)
+{
+    lattice_hsv_row((unsigned char *)text_reserve(buffer,3*Y),i,0);
+    buffer->n+=3*Y;
+}
+
+// Outputs a bitmap of lattice dipole orientation on a HSV colourwheel; a PNG,
+// else (!NativePNG) the binary PPM it has always been
+void outputlattice_ppm_hsv(char * filename)
+{
+    unsigned char *rgb;
+    int i;
+    FILE *fo;
+
+    if (NativePNG)
+    {
+        rgb=(unsigned char *)malloc(3*X*Y);
+#pragma omp parallel for
+        for (i=0;i<X;i++) //force same ordering as SVG...
+            lattice_hsv_row(rgb+3*Y*i,i,0);
+        png_write(filename,rgb,Y,X,3,8);
+        free(rgb);
+        return;
+    }
+
+    fo=fopen(filename,"w");
+
+    fprintf (fo,"P6\n%d %d\n255\n", X, Y);
+
+    text_slabs(fo,X,lattice_ppm_hsv_slab,NULL); //force same ordering as SVG...
     fclose(fo); //don't forget :^)
 }
 
@@ -707,40 +815,68 @@ void outputlattice_svg(char * filename)
 
 #define ZSCALE 5.0 // Scales Z-axis in Pymol xyz / CGO outputs
 
-void outputlattice_xyz(char * filename)
+// "%s %f %f %f\n" atom x y z
+static char * text_atom(char *q, char atom, double x, double y, double z)
 {
-    int x,y,z;
+    *q++=atom; *q++=' ';
+    q=text_fixed(q,x,6); *q++=' ';
+    q=text_fixed(q,y,6); *q++=' ';
+    q=text_fixed(q,z,6); *q++='\n';
+    return(q);
+}
+
+static void lattice_xyz_slab(struct textbuffer *b, int x, void *arg)
+{
+    int y,z;
     float r=1.6/2; // half length of C-N molecule
     float d=4.0; // lattice size - for placing molecule
     // artificially small - to make molecules relatively bigger!
     // Nb: set to 3.0 to get pymol to draw bonds between aligned MA    
+    char *q;
+
+    for (y=0;y<Y;y++)
+        for (z=0;z<Z;z++)
+        {
+            q=text_reserve(b,2*TEXT_LINE);
+            q=text_atom(q,'C',d*x+r*lattice[x][y][z].x, d*y+r*lattice[x][y][z].y, ZSCALE*(d*z)+r*lattice[x][y][z].z);
+            q=text_atom(q,'N',d*x-r*lattice[x][y][z].x, d*y-r*lattice[x][y][z].y, ZSCALE*(d*z)-r*lattice[x][y][z].z);
+            b->n=q-b->p;
+        }
+}
+
+void outputlattice_xyz(char * filename)
+{
     FILE *fo;
     fo=fopen(filename,"w");
     fprintf(fo,"%d\n\n",X*Y*Z*2); //number of atoms... i.e. lattice sites times 2
 
-    for (x=0;x<X;x++)
-        for (y=0;y<Y;y++)
-            for (z=0;z<Z;z++)
-            {
-                fprintf(fo,"C %f %f %f\n",d*x+r*lattice[x][y][z].x, d*y+r*lattice[x][y][z].y, ZSCALE*(d*z)+r*lattice[x][y][z].z);
-                fprintf(fo,"N %f %f %f\n",d*x-r*lattice[x][y][z].x, d*y-r*lattice[x][y][z].y, ZSCALE*(d*z)-r*lattice[x][y][z].z);
-            }
+    text_slabs(fo,X,lattice_xyz_slab,NULL);
+    fclose(fo);
 }
 
-void outputlattice_xyz_overprint(char * filename)
+static void lattice_xyz_overprint_slab(struct textbuffer *b, int x, void *arg)
 {
-    int x,y,z;
+    int y,z;
     float r=6.0; // half length of C-N molecule
-    float d=6.4; // lattice size - for placing molecule
+    char *q;
 
+    for (y=0;y<Y;y++)
+        for (z=0;z<Z;z++)
+        {
+            q=text_reserve(b,TEXT_LINE);
+            q=text_atom(q,'N',r*lattice[x][y][z].x, r*lattice[x][y][z].y, r*lattice[x][y][z].z);
+            b->n=q-b->p;
+        }
+}
+
+void outputlattice_xyz_overprint(char * filename)
+{
     FILE *fo;
     fo=fopen(filename,"w");
     fprintf(fo,"%d\n\nC 0.0 0.0 0.0\n",1+(X*Y*Z)); //number of atoms...
 
-    for (x=0;x<X;x++)
-        for (y=0;y<Y;y++)
-            for (z=0;z<Z;z++)
-                fprintf(fo,"N %f %f %f\n",r*lattice[x][y][z].x, r*lattice[x][y][z].y, r*lattice[x][y][z].z);
+    text_slabs(fo,X,lattice_xyz_overprint_slab,NULL);
+    fclose(fo);
 }
 
 // Outputs Pymol CGO sphere primitives of lattice dipole orientation on a HSV colourwheel
@@ -817,6 +953,8 @@ void outputlattice_pymol_cgo(char * filename)
 
 float DMAX=55.0; //sensible starting value...
 
+// Composed into a frame, and drawn at most TerminalFPS a second (see
+// starrynight-terminal.c); in place, only what changed is redrawn
 void outputlattice_dumb_terminal()
 {
     const char * arrows="-\\|/-\\|/"; // "Dancing at angles"
@@ -828,14 +966,22 @@ void outputlattice_dumb_terminal()
     float potential;
     float variance=0.0; // sum of potential^2
     float mean=0.0;
+    double *phi;
+    char line[TEXT_LINE];
+    struct termframe *f;
+
+    if (!terminal_due(TERM_LATTICE)) return; // not composed either
+    phi=lattice_potential();
+    f=terminal_frame(TERM_LATTICE);
 
-    fprintf(stderr,"%*s%*s\n",X+3, "DIPOLES", (2*X)+4,"POTENTIAL"); //padded labels
+    sprintf(line,"%*s%*s",X+3, "DIPOLES", (2*X)+4,"POTENTIAL"); //padded labels
+    terminal_text(f,0,0,line);
 
     // pre-compute maximum potential; for calibrating the scale
     for (y=0;y<Y;y++)
         for (x=0;x<X;x++)
         {
-            potential=dipole_potential(x,y,z);
+            potential=phi[(x*Y+y)*Z+z];
 
             if (fabs(potential)>new_DMAX)
                 new_DMAX=fabs(potential); // used to calibrate scale - technically this changes
@@ -860,10 +1006,6 @@ void outputlattice_dumb_terminal()
             // Empty site --> colour white
             if (lattice[x][y][z].length==0.0) a=7; 
 
-            fprintf (stderr,"%c[%d",27,31+((int)a)%8 ); // Sets colour of output routine
-            if (a<4.0)                                  // makes colour bold / normal depending on arrow orientation
-                fprintf(stderr,";7");
-            
             char arrow=arrows[(int)a];
             // Pointing towards you / into screen; --> o and x
             if (lattice[x][y][z].z> sqrt(2)/2.0) arrow='o';
@@ -872,34 +1014,26 @@ void outputlattice_dumb_terminal()
             // Empty site --> 
             if (lattice[x][y][z].length==0.0) arrow='#';
 
-            fprintf(stderr,"m%c %c[0m",arrow,27);  // prints arrow
-            fprintf(stderr,"%c[37m%c[0m",27,27); //RESET
-
-            //            fprintf(stderr,"%c ",arrows[(int)a]); // dumb - just black 'n'
-            //            white
+            // colour of the arrow; reversed (bold) or normal depending on orientation
+            terminal_cell(f,1+y,2*x,arrow,31+((int)a)%8,a<4.0,-1);
+            terminal_cell(f,1+y,2*x+1,' ',31+((int)a)%8,a<4.0,-1);
         }
 
         // OK - now potential plot :^)
         //        const char * density=".,:;o*O#"; //increasing potential density
         const char * density="012345689";
-        fprintf(stderr,"    ");
         for (x=0;x<X;x++)
         {
-            potential=dipole_potential(x,y,z);
+            potential=phi[(x*Y+y)*Z+z];
             variance+=potential*potential;
             mean+=potential;
 
             if (fabs(potential)>new_DMAX)
                 new_DMAX=fabs(potential); // used to calibrate scale - technically this changes
-            //printf("%f\t",potential); //debug routine to get scale
 
-            //fprintf(stderr,"%c[%d",27,31+((int)(8.0*fabs(potential)/DMAX))%8); //8 colours
-            //fprintf(stderr,"%c[48;5;%d",27,17+(int)(214.0*fabs(potential)/DMAX)); // Xterm 256 color map - (16..231)
-            fprintf(stderr,"%c[48;5;%d",27,232+12+(int)(11.0*potential/DMAX)); // Xterm 256 color map - shades of grey (232..255)
+            // Xterm 256 color map - shades of grey (232..255)
             // https://code.google.com/p/conemu-maximus5/wiki/AnsiEscapeCodes#xterm_256_color_processing_requirements
-
-            //if (potential<0.0) // if negative
-            //    fprintf(stderr,";7"); // bold
+            int grey=232+12+(int)(11.0*potential/DMAX);
 
             a=atan2(lattice[x][y][z].y,lattice[x][y][z].x);
             a=a/(M_PI); //fraction of circle
@@ -914,15 +1048,15 @@ void outputlattice_dumb_terminal()
             if (lattice[x][y][z].z> sqrt(2)/2.0) arrow='o'; // override for 'up' (towards you - physics arrow style 'o')
             if (lattice[x][y][z].z<-sqrt(2)/2.0) arrow='x'; // and 'down' (away from you, physics arrow style 'x')
 
-
-            fprintf(stderr,"m%c%c%c[0m",density[(int)(8.0*fabs(potential)/DMAX)],arrow,27);
+            terminal_cell(f,1+y,2*X+4+2*x,density[(int)(8.0*fabs(potential)/DMAX)],0,false,grey);
+            terminal_cell(f,1+y,2*X+4+2*x+1,arrow,0,false,grey);
         }
-
-        fprintf(stderr,"\n");
     }
     mean=mean/(X*Y);
     variance=variance/(X*Y); 
-    fprintf(stderr,"T: %d DMAX: %f new_DMAX: %f variance: %f mean: %f\n",T,DMAX,new_DMAX,variance,mean);
+    sprintf(line,"T: %d DMAX: %f new_DMAX: %f variance: %f mean: %f",T,DMAX,new_DMAX,variance,mean);
+    terminal_text(f,Y+1,0,line);
+    terminal_draw(f,TERM_LATTICE);
     //fprintf(stdout,"CageStrain: %f T: %d DMAX: %f new_DMAX: %f variance: %f mean: %f\n",CageStrain,T,DMAX,new_DMAX,variance,mean);
     DMAX=(new_DMAX+DMAX)/2.0; // mean of old and new (sampled, noisy) value
     DMAX=new_DMAX; // infinite fast following - but leads to fluctuations at steady state
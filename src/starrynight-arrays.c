@@ -0,0 +1,155 @@
+/* Starry Night - a Monte Carlo code to simulate ferroelectric domain formation
+ * and behaviour in hybrid perovskite solar cells.
+ *
+ * By Jarvist Moore Frost
+ * University of Bath
+ *
+ * File begun 16th January 2014
+ */
+
+// Volumetric outputs as arrays that can be mmap()ed, rather than parsed:
+// NumPy .npy (ArrayFormat: "npy"), or bare native arrays (ArrayFormat: "raw"),
+// each with a JSON sidecar (<file>.json) giving the dtype, shape, and the
+// offset of the data in the file. C order; the .npy header is padded so the
+// data starts 64 byte aligned. Written straight from the simulation's own
+// arrays, in one writev().
+//
+//  *_potential  float64 (X,Y,Z)      phi, internal units
+//  *_efield     float64 (3,X,Y,Z)    E on the site lattice; *_efieldoffset on
+//                                    the half-offset lattice
+//  *_dipoles    float32 (X,Y,Z,4)    px py pz length
+//  *_recombination float64 (2,X,Y,Z) electron, hole densities (Fermi-Dirac,
+//                                    normalised to sum to 1) for the first
+//                                    RecombinationkT, RecombinationDielectric
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#ifndef IOV_MAX
+#define IOV_MAX 1024 // POSIX minimum
+#endif
+
+// Prototypes...
+static void array_write(char * filename, char type, int size, int ndim, int *shape,
+        struct iovec *data, int n, const char * description);
+static void arrays_write(char * prefix);
+static void recombination_densities(char * filename); // in analysis
+
+// writev() all of iov, however many (IOV_MAX at a time) and however short
+static int writev_all(int fd, struct iovec *iov, int n)
+{
+    ssize_t done;
+    int chunk;
+
+    while (n>0)
+    {
+        chunk=n<IOV_MAX ? n : IOV_MAX;
+        done=writev(fd,iov,chunk);
+        if (done<0) return(false);
+        for (;n>0 && done>=(ssize_t)iov->iov_len;iov++,n--) done-=iov->iov_len;
+        if (n>0) // partial element
+        {
+            iov->iov_base=(char *)iov->iov_base+done;
+            iov->iov_len-=done;
+        }
+    }
+    return(true);
+}
+
+// type: 'f' float, 'i' signed, 'u' unsigned; size in bytes
+static void array_write(char * filename, char type, int size, int ndim, int *shape,
+        struct iovec *data, int n, const char * description)
+{
+    union { uint16_t i; unsigned char c[2]; } endian={1};
+    char order=endian.c[0] ? '<' : '>';
+    char header[256],dims[128],*json;
+    int i,len=0,fd;
+    struct iovec *iov;
+    FILE *fo;
+
+    dims[0]='\0';
+    for (i=0;i<ndim;i++)
+        sprintf(dims+strlen(dims),"%s%d",i ? ", " : "",shape[i]);
+
+    if (strcmp(ArrayFormat,"raw")!=0) // NPY 1.0: magic, version, uint16 length, dict
+    {
+        len=sprintf(header+10,"{'descr': '%c%c%d', 'fortran_order': False, 'shape': (%s%s), }",
+                order,type,size,dims,ndim==1 ? "," : ""); // (n,) for a 1-tuple
+        while ((10+len+1)%64) header[10+len++]=' ';
+        header[10+len++]='\n';
+        memcpy(header,"\x93NUMPY\x01\x00",8);
+        header[8]=len&0xFF; header[9]=len>>8;
+        len+=10;
+    }
+
+    iov=(struct iovec *)malloc(sizeof(struct iovec)*(n+1));
+    iov[0].iov_base=header; iov[0].iov_len=len;
+    memcpy(iov+1,data,sizeof(struct iovec)*n);
+
+    fd=open(filename,O_WRONLY|O_CREAT|O_TRUNC,0644);
+    if (fd<0 || !writev_all(fd,iov,n+1))
+        fprintf(stderr,"Arrays: failed to write %s\n",filename);
+    if (fd>=0) close(fd);
+    free(iov);
+
+    json=(char *)malloc(strlen(filename)+sizeof(".json"));
+    sprintf(json,"%s.json",filename);
+    fo=fopen(json,"w");
+    fprintf(fo,"{\"file\": \"%s\", \"format\": \"%s\", \"offset\": %d, \"dtype\": \"%c%c%d\", "
+            "\"endian\": \"%s\", \"order\": \"C\", \"shape\": [%s], "
+            "\"description\": \"%s\", \"T\": %d, \"moves\": %lu}\n",
+            filename,len ? "npy" : "raw",len,order,type,size,
+            order=='<' ? "little" : "big",dims,description,T,ACCEPT+REJECT);
+    fclose(fo);
+    free(json);
+}
+
+static void arrays_write(char * prefix)
+{
+    char *name=(char *)malloc(strlen(prefix)+sizeof("_recombination.npy")); // longest below
+    const char *ext=strcmp(ArrayFormat,"raw")==0 ? "raw" : "npy";
+    int shape[4];
+    int x,y;
+    struct iovec *iov;
+
+    // potential: the (cached) phi as is
+    shape[0]=X; shape[1]=Y; shape[2]=Z;
+    iov=(struct iovec *)malloc(sizeof(struct iovec)*(X*Y+3));
+    iov[0].iov_base=lattice_potential(); iov[0].iov_len=sizeof(double)*X*Y*Z;
+    sprintf(name,"%s_potential.%s",prefix,ext);
+    array_write(name,'f',sizeof(double),3,shape,iov,1,"electrostatic potential, internal units");
+
+    // dipoles: a struct dipole[Z] row per (x,y), as float x y z length
+    for (x=0;x<X;x++)
+        for (y=0;y<Y;y++)
+        {
+            iov[x*Y+y].iov_base=lattice[x][y];
+            iov[x*Y+y].iov_len=sizeof(struct dipole)*Z;
+        }
+    shape[3]=sizeof(struct dipole)/sizeof(float);
+    sprintf(name,"%s_dipoles.%s",prefix,ext);
+    array_write(name,'f',sizeof(float),4,shape,iov,X*Y,"dipoles: px py pz length");
+
+    // vector fields: component arrays, one after the other
+    if (CalculateEfield || SaveEfieldBinary)
+    {
+        lattice_efield();
+        shape[0]=3; shape[1]=X; shape[2]=Y; shape[3]=Z;
+        iov[0].iov_base=efield_site.x; iov[1].iov_base=efield_site.y; iov[2].iov_base=efield_site.z;
+        iov[0].iov_len=iov[1].iov_len=iov[2].iov_len=sizeof(double)*X*Y*Z;
+        sprintf(name,"%s_efield.%s",prefix,ext);
+        array_write(name,'f',sizeof(double),4,shape,iov,3,"electric field Ex Ey Ez, site lattice");
+
+        iov[0].iov_base=efield_offset.x; iov[1].iov_base=efield_offset.y; iov[2].iov_base=efield_offset.z;
+        sprintf(name,"%s_efieldoffset.%s",prefix,ext);
+        array_write(name,'f',sizeof(double),4,shape,iov,3,"electric field Ex Ey Ez, half-offset lattice");
+    }
+    free(iov);
+
+    if (CalculateRecombination)
+    {
+        sprintf(name,"%s_recombination.%s",prefix,ext);
+        recombination_densities(name);
+    }
+    free(name);
+}
@@ -0,0 +1,185 @@
+/* Starry Night - a Monte Carlo code to simulate ferroelectric domain formation
+ * and behaviour in hybrid perovskite solar cells.
+ *
+ * By Jarvist Moore Frost
+ * University of Bath
+ *
+ * File begun 16th January 2014
+ */
+
+// Run length control from the data itself, rather than fixed MCEqmSteps /
+// MCMegaSteps guesses. Energy and order parameter are recorded once per sweep
+// (from the running totals, so for free), online, in bounded memory; then
+//  - equilibration is detected with MSER (White 1997) truncation, on batch
+//    means of 5 sweeps; when the buffer fills, neighbouring batches merge
+//    (10, 20, ... sweeps), so a long equilibration costs no more
+//  - integrated autocorrelation times come from blocking (Flyvbjerg &
+//    Petersen 1989): running variances of block means of 1, 2, 4, ... sweeps,
+//    extrapolated in block size, read at the first block size of at least
+//    6 tau (c.f. Sokal's window)
+//  - production stops once the effective sample size reaches TargetESS
+// Each sweep is O(1) amortised, and each check O(MSERBATCHES + BLOCKLEVELS).
+
+enum {MSERBATCHES=4096, BLOCKLEVELS=48};
+
+struct series
+{
+    int n; // sweeps
+    // MSER: batch means, of 'batch' sweeps each
+    double means[MSERBATCHES];
+    int nb,batch;
+    double partial; int inpartial; // the batch being filled
+    // blocking: level k holds the means of blocks of 2^k sweeps
+    struct
+    {
+        long n;
+        double mean,M2; // Welford
+        double held; int holding; // first of the next pair
+    } level[BLOCKLEVELS];
+} Eseries={.batch=5}, mseries={.batch=5}; // one entry per MC sweep
+
+// Prototypes...
+static void series_push(struct series *s, double value);
+static void autocorrelation_sample();
+static void autocorrelation_reset();
+static int mser_truncation(struct series *s);
+static double tau_int(struct series *s);
+static int equilibrated(FILE *log);
+static int converged(FILE *log);
+
+// Block mean x into level k, and pairs of them into the levels above
+static void series_block(struct series *s, int k, double x)
+{
+    double delta;
+
+    for (;k<BLOCKLEVELS;k++)
+    {
+        s->level[k].n++;
+        delta=x-s->level[k].mean;
+        s->level[k].mean+=delta/s->level[k].n;
+        s->level[k].M2+=delta*(x-s->level[k].mean);
+
+        if (!s->level[k].holding)
+        {
+            s->level[k].held=x;
+            s->level[k].holding=true;
+            return;
+        }
+        x=0.5*(s->level[k].held+x);
+        s->level[k].holding=false;
+    }
+}
+
+static void series_push(struct series *s, double value)
+{
+    int i;
+
+    s->n++;
+    series_block(s,0,value);
+
+    s->partial+=value;
+    if (++s->inpartial<s->batch) return;
+    if (s->nb==MSERBATCHES) // full; merge pairs, doubling the batch
+    {
+        for (i=0;i<MSERBATCHES/2;i++)
+            s->means[i]=0.5*(s->means[2*i]+s->means[2*i+1]);
+        s->nb=MSERBATCHES/2;
+        s->batch*=2;
+        if (s->inpartial<s->batch) return; // this batch isn't full after all
+    }
+    s->means[s->nb++]=s->partial/s->inpartial;
+    s->partial=0.0; s->inpartial=0;
+}
+
+// Called once per sweep from MC_moves()
+static void autocorrelation_sample()
+{
+    series_push(&Eseries,Etotal);
+    series_push(&mseries,sqrt(landau_order_running()));
+}
+
+static void autocorrelation_reset()
+{
+    memset(&Eseries,0,sizeof(struct series)); Eseries.batch=5;
+    memset(&mseries,0,sizeof(struct series)); mseries.batch=5;
+}
+
+// MSER: truncate the first d batches where d minimises the squared standard
+// error of the remainder,
+//   MSER(d) = sum_{i>=d} (x_i - xbar_d)^2 / (nb-d)^2
+// Suffix sums make this O(nb). Returns truncation point in sweeps.
+static int mser_truncation(struct series *s)
+{
+    int nb=s->nb;
+    int d,best=0;
+    double sum=0.0, sum2=0.0, mean, mser, bestmser=INFINITY;
+
+    if (nb<10) return(s->n); // too few to say anything
+
+    // walk d down from the end, accumulating the tail sums
+    for (d=nb-1;d>=0;d--)
+    {
+        sum+=s->means[d]; sum2+=s->means[d]*s->means[d];
+        if (d>nb/2) continue; // d is only allowed in the first half
+        mean=sum/(nb-d);
+        mser=(sum2-(nb-d)*mean*mean)/((double)(nb-d)*(nb-d));
+        if (mser<=bestmser) { bestmser=mser; best=d; }
+    }
+
+    return(best*s->batch);
+}
+
+// Integrated autocorrelation time (in sweeps), by blocking: for blocks of b
+// sweeps, 2 tau_b = b var(block means)/var(sweeps) = 2 tau - A/b + ..., so
+// the 1/b bias is cancelled between successive levels: tau = 2 tau_2b - tau_b.
+// Read at the first level with b >= c*tau, c=6, and enough blocks to trust.
+static double tau_int(struct series *s)
+{
+    const double c=6.0;
+    const int MINBLOCKS=16;
+    int k;
+    double var0,tau,tauk,last=0.5;
+
+    if (s->level[0].n<2) return(INFINITY);
+    var0=s->level[0].M2/s->level[0].n;
+    if (var0==0.0) return(0.5);
+
+    for (k=0;k<BLOCKLEVELS && s->level[k].n>=MINBLOCKS;k++)
+    {
+        tauk=0.5*(double)(1L<<k)*(s->level[k].M2/s->level[k].n)/var0;
+        tau= k>0 ? 2.0*tauk-last : tauk;
+        last=tauk;
+        if (tau<0.5) tau=0.5; // uncorrelated, within noise
+        if (k>0 && (double)(1L<<k)>=c*tau) return(tau);
+    }
+    return(INFINITY); // blocks never long enough; series too short
+}
+
+// Equilibrated once MSER would truncate less than half of what we have.
+static int equilibrated(FILE *log)
+{
+    int dE=mser_truncation(&Eseries);
+    int dm=mser_truncation(&mseries);
+    int d=dE>dm ? dE : dm;
+
+    fprintf(stderr,"MSER: %d sweeps; truncation E: %d m: %d\n",Eseries.n,dE,dm);
+    if (d>=Eseries.n/2) return(false);
+
+    fprintf(log,"# Equilibrated after %d sweeps (MSER truncation %d)\n",Eseries.n,d);
+    return(true);
+}
+
+// Effective sample size N/(2 tau) of both E and m reached TargetESS?
+static int converged(FILE *log)
+{
+    double tauE=tau_int(&Eseries);
+    double taum=tau_int(&mseries);
+    double essE=Eseries.n/(2.0*tauE);
+    double essm=mseries.n/(2.0*taum);
+
+    fprintf(stderr,"Autocorrelation: %d sweeps; tau_E: %.2f tau_m: %.2f ESS_E: %.1f ESS_m: %.1f (target %d)\n",
+            Eseries.n,tauE,taum,essE,essm,TargetESS);
+    fprintf(log,"# sweeps: %d tau_E: %f tau_m: %f ESS_E: %f ESS_m: %f\n",Eseries.n,tauE,taum,essE,essm);
+
+    return(essE>=TargetESS && essm>=TargetESS);
+}
@@ -26,6 +26,25 @@ int T; //global variable so accessible to analysis routines
 unsigned long ACCEPT=0; //counters for MC moves
 unsigned long REJECT=0;
 
+// Running total energy of the lattice, and its split into the terms of the
+// Hamiltonian. Seeded by a full lattice_energy() evaluation, then kept current
+// by adding the dE of every accepted move.
+double Etotal=0.0;
+struct energy
+{
+    double dipole; // dipole-dipole
+    double strain; // cage strain (nearest neighbours)
+    double field;  // applied Efield
+    double K;      // epitaxial strain
+} Eterms, dEterms; // dEterms: split of the last site_energy() call
+
+// Running total of the dipole orientations (unweighted by length, as in
+// polarisation() and landau_order()); updated by every accepted move.
+struct
+{
+    double x,y,z;
+} Ptotal;
+
 // CUSTOM STRUCTURES
 // This is used to build the lattice of dipoles. Note that we use 32bit floats
 // for a compact (in memory) representation, that can fit in the cache.
@@ -35,6 +54,10 @@ struct dipole
     float length; //length of dipole, to allow for solid state mixture (MA, FA, Ammonia, etc.)
 } ***lattice;
 
+// Bumped on every change to the lattice; derived fields (potential etc.) are
+// cached against it, so are only recomputed when the lattice has moved on.
+unsigned long lattice_version=0;
+
 // Structure to store solid-solution of different 'dipoles'
 struct mixture
 {
@@ -79,18 +102,129 @@ char const *LOGFILE = NULL; //for output filenames
 // Simulation display / calculation flags
 // False = 0 ; True = 1
 int DisplayDumbTerminal=true;
+int TerminalInPlace=true; // pinned display, redrawn where changed (stderr a terminal)
+double TerminalFPS=4.0; // most frames a second; 0 for every one
 int CalculateRecombination=true;
+// Recombination is evaluated for every pair of these, in one pass
+enum {MAXRECOMBINATION=10}; // of each
+double RecombinationkT[MAXRECOMBINATION]={0.025}; // eV
+int RecombinationkTs=1;
+double RecombinationDielectric[MAXRECOMBINATION]={5.0}; // screens the electrostatic potential
+int RecombinationDielectrics=1;
 int CalculateRadialOrderParameter=false;
+int RadialCutOff=9; // radial order parameter for r < RadialCutOff
+int CalculateStructureFactor=false;
+int CalculateDomains=false; // cluster labelling of similarly oriented dipoles
+double DomainAngle=30.0; // degrees; neighbours within this are in one domain
+int DomainMinSize=8; // clusters listed individually in the domain log
+int SaveDomainLabels=false; // label volume, every MC megastep
+
+// Domain wall tracking, logged every sweep
+int TrackWalls=false;
+double WallThreshold=0.0; // neighbours with dot product below this are a wall
+int WallAntiparallel=false; // use |dot|; antiparallel neighbours are not a wall
+double WallOrigin=0.0; // wall positions along x are measured from here
+
+// Orientation distribution per species, on an equal area grid, every megastep
+int CalculateOrientations=false;
+int OrientationBands=18; // bands in cos(theta); twice as many sectors in phi
+
+// Megastep output routines in forked (copy-on-write) snapshots, alongside MC
+int AsyncAnalysis=false;
+int AnalysisQueue=2; // snapshots in flight before MC waits
+
+// Binary trajectory: a frame every TrajectoryInterval sweeps, delta encoded
+// against the previous frame, with a key frame every TrajectoryKeyframe
+int SaveTrajectory=false;
+int TrajectoryInterval=1;
+int TrajectoryDelta=true;
+int TrajectoryKeyframe=100;
+
+// Quantised snapshots: orientations snapped to an octahedral grid of 2 x
+// OctahedralBits (8 or 16), so the lattice can be saved losslessly in that
+// compact form. No saving in memory; the lattice is still struct dipole
+int QuantiseDipoles=false;
+int OctahedralBits=16;
+int SaveDipolesOctahedral=false;
+
+// The .png pictures as PNGs (else PNM, as ever); upscaled PNGScale times,
+// deflated at zlib level PNGCompression
+int NativePNG=true;
+int PNGScale=1;
+int PNGCompression=6;
+
+// Live video of a plane of dipoles (+ potential), for ffmpeg etc.
+int VideoStream=false;
+char const *VideoOutput = "-"; // stdout, or a file / named pipe
+char const *VideoFormat = "y4m"; // or "rgb"
+int VideoInterval=1; // sweeps a frame
+int VideoScale=4; // pixels a site
+int VideoSlice=0; // z plane
+int VideoPotential=false; // potential beside the dipoles
+int VideoFPS=25;
+
+// Potential, field, dipoles, densities as mmap()able arrays + JSON sidecars
+int SaveArrays=false;
+char const *ArrayFormat = "npy"; // or "raw"
+
+// Cadence of the megastep outputs; read as <name>Interval, <name>Budget
+enum {OBS_ORIENTATIONS, OBS_TERMINAL, OBS_RECOMBINATION, OBS_RDF, OBS_DOMAINS,
+    OBS_EFIELD, OBS_DOMAINLABELS, OBS_POTENTIALXYZ, OBS_POTENTIALCUBE,
+    OBS_POTENTIALPNG, OBS_DIPOLESPNG, OBS_DIPOLESSVG, OBS_DIPOLESOCTAHEDRAL,
+    OBS_ARRAYS, OBSERVABLES};
+struct observable
+{
+    const char *name;
+    int interval; // sweeps between outputs; 0 = every megastep
+    double budget; // maximum fraction of wall time; 0 = no limit
+    double effective; // interval in use, after adapting to the budget
+    double last; // sweep of the last output
+    double cost; // total, in seconds
+    int due;
+} observables[OBSERVABLES]={
+    {"Orientations"}, {"Terminal"}, {"Recombination"}, {"RDF"}, {"Domains"},
+    {"Efield"}, {"DomainLabels"}, {"PotentialXYZ"}, {"PotentialCube"},
+    {"PotentialPNG"}, {"DipolesPNG"}, {"DipolesSVG"}, {"DipolesOctahedral"},
+    {"Arrays"}};
 
 int ConstrainToX=false;
 
 int CalculatePotential=false;
 int CalculateEfield=false;
+int SaveEfieldBinary=false; // full vector field, site + offset lattices
 
 int SaveDipolesXYZ=false;
 int SaveDipolesPNG=false;
 int SaveDipolesSVG=false;
 int SavePotentialCube=false;
+int PotentialPeriodic=false; // false: potential cut off at 6 lattice units (as always); true: full periodic (Ewald) sum
+int IncrementalPotential=false; // keep potential current with every accepted move
+
+// Wang-Landau density of states, then multicanonical production run
+int WangLandau=false;
+int WangLandauBins=200;
+double WangLandauEmin=0.0; // Emin>=Emax --> window found by probing
+double WangLandauEmax=0.0;
+double WangLandauFlatness=0.8;
+double WangLandauFinalLnF=1e-6;
+int MulticanonicalSweeps=10000;
+int WangLandauTmin=0; // temperature grid for reweighted canonical averages
+int WangLandauTmax=1000;
+int WangLandauTstep=10;
+
+// Joint (E, P, Landau) sample stream, for histogram reweighting
+int SaveSamples=false;
+int SamplesPerMegaStep=20;
+
+int LogEnergy=false; // running energy terms to log, every MC megastep
+int EnergyCheckInterval=10; // MC megasteps between brute force drift checks; 0 = never
+int LogMoments=false; // <P>, susceptibility, heat capacity, Binder cumulant to log
+
+// Run length from the data: MCEqmSteps / MCMegaSteps become minimums
+int AutoEquilibrate=false;
+int MaxMCEqmSteps=1000;
+int MaxMCMegaSteps=10000;
+int TargetESS=1000; // effective (independent) samples of E and |P|
 
 //END OF SIMULATION PARAMETERS
 // {{ Except for the ones hardcoded into the algorithm :^) }}
@@ -167,16 +301,124 @@ void load_config()
 
 // Simulation display / calculation flags
     config_lookup_bool(cf,"DisplayDumbTerminal",&DisplayDumbTerminal);
+    config_lookup_bool(cf,"TerminalInPlace",&TerminalInPlace);
+    config_lookup_float(cf,"TerminalFPS",&TerminalFPS);
     config_lookup_bool(cf,"CalculateRecombination",&CalculateRecombination);
+    setting = config_lookup(cf, "RecombinationkT");
+    if (setting!=NULL)
+    {
+        RecombinationkTs = config_setting_length(setting);
+        if (RecombinationkTs<1 || RecombinationkTs>MAXRECOMBINATION)
+        {
+            fprintf(stderr,"RecombinationkT: %d values; must be 1 to %d.\n",RecombinationkTs,MAXRECOMBINATION);
+            exit(EXIT_FAILURE);
+        }
+        for (i=0;i<RecombinationkTs;i++)
+            RecombinationkT[i]=config_setting_get_float_elem(setting,i);
+    }
+    setting = config_lookup(cf, "RecombinationDielectric");
+    if (setting!=NULL)
+    {
+        RecombinationDielectrics = config_setting_length(setting);
+        if (RecombinationDielectrics<1 || RecombinationDielectrics>MAXRECOMBINATION)
+        {
+            fprintf(stderr,"RecombinationDielectric: %d values; must be 1 to %d.\n",RecombinationDielectrics,MAXRECOMBINATION);
+            exit(EXIT_FAILURE);
+        }
+        for (i=0;i<RecombinationDielectrics;i++)
+            RecombinationDielectric[i]=config_setting_get_float_elem(setting,i);
+    }
     config_lookup_bool(cf,"CalculateRadialOrderParameter",&CalculateRadialOrderParameter);
+    config_lookup_int(cf,"RadialCutOff",&RadialCutOff);
+    config_lookup_bool(cf,"CalculateStructureFactor",&CalculateStructureFactor);
+    config_lookup_bool(cf,"CalculateDomains",&CalculateDomains);
+    config_lookup_float(cf,"DomainAngle",&DomainAngle);
+    config_lookup_int(cf,"DomainMinSize",&DomainMinSize);
+    config_lookup_bool(cf,"SaveDomainLabels",&SaveDomainLabels);
+
+    config_lookup_bool(cf,"TrackWalls",&TrackWalls);
+    config_lookup_float(cf,"WallThreshold",&WallThreshold);
+    config_lookup_bool(cf,"WallAntiparallel",&WallAntiparallel);
+    config_lookup_float(cf,"WallOrigin",&WallOrigin);
+
+    config_lookup_bool(cf,"CalculateOrientations",&CalculateOrientations);
+    config_lookup_int(cf,"OrientationBands",&OrientationBands);
+
+    config_lookup_bool(cf,"AsyncAnalysis",&AsyncAnalysis);
+    config_lookup_int(cf,"AnalysisQueue",&AnalysisQueue);
+
+    config_lookup_bool(cf,"SaveTrajectory",&SaveTrajectory);
+    config_lookup_int(cf,"TrajectoryInterval",&TrajectoryInterval);
+    config_lookup_bool(cf,"TrajectoryDelta",&TrajectoryDelta);
+    config_lookup_int(cf,"TrajectoryKeyframe",&TrajectoryKeyframe);
+
+    config_lookup_bool(cf,"QuantiseDipoles",&QuantiseDipoles);
+    config_lookup_int(cf,"OctahedralBits",&OctahedralBits);
+    if (OctahedralBits!=8) OctahedralBits=16; // the only two encodings
+    config_lookup_bool(cf,"SaveDipolesOctahedral",&SaveDipolesOctahedral);
+
+    config_lookup_bool(cf,"NativePNG",&NativePNG);
+    config_lookup_int(cf,"PNGScale",&PNGScale);
+    config_lookup_int(cf,"PNGCompression",&PNGCompression);
+
+    config_lookup_bool(cf,"VideoStream",&VideoStream);
+    config_lookup_string(cf,"VideoOutput",&VideoOutput);
+    config_lookup_string(cf,"VideoFormat",&VideoFormat);
+    config_lookup_int(cf,"VideoInterval",&VideoInterval);
+    config_lookup_int(cf,"VideoScale",&VideoScale);
+    config_lookup_int(cf,"VideoSlice",&VideoSlice);
+    config_lookup_bool(cf,"VideoPotential",&VideoPotential);
+    config_lookup_int(cf,"VideoFPS",&VideoFPS);
+
+    config_lookup_bool(cf,"SaveArrays",&SaveArrays);
+    config_lookup_string(cf,"ArrayFormat",&ArrayFormat);
+
+    for (i=0;i<OBSERVABLES;i++)
+    {
+        sprintf(name,"%sInterval",observables[i].name);
+        config_lookup_int(cf,name,&observables[i].interval);
+        sprintf(name,"%sBudget",observables[i].name);
+        config_lookup_float(cf,name,&observables[i].budget);
+    }
       
     config_lookup_bool(cf,"CalculatePotential",&CalculatePotential);
     config_lookup_bool(cf,"CalculateEfield",&CalculateEfield);
+    config_lookup_bool(cf,"SaveEfieldBinary",&SaveEfieldBinary);
     
     config_lookup_bool(cf,"SaveDipolesSVG",&SaveDipolesSVG);
     config_lookup_bool(cf,"SaveDipolesPNG",&SaveDipolesPNG);
     config_lookup_bool(cf,"SaveDipolesXYZ",&SaveDipolesXYZ);
     config_lookup_bool(cf,"SavePotentialCube",&SavePotentialCube);
+    config_lookup_bool(cf,"PotentialPeriodic",&PotentialPeriodic);
+    config_lookup_bool(cf,"IncrementalPotential",&IncrementalPotential);
+
+    config_lookup_bool(cf,"WangLandau",&WangLandau);
+    config_lookup_int(cf,"WangLandauBins",&WangLandauBins);
+    config_lookup_float(cf,"WangLandauEmin",&WangLandauEmin);
+    config_lookup_float(cf,"WangLandauEmax",&WangLandauEmax);
+    config_lookup_float(cf,"WangLandauFlatness",&WangLandauFlatness);
+    config_lookup_float(cf,"WangLandauFinalLnF",&WangLandauFinalLnF);
+    config_lookup_int(cf,"MulticanonicalSweeps",&MulticanonicalSweeps);
+    config_lookup_int(cf,"WangLandauTmin",&WangLandauTmin);
+    config_lookup_int(cf,"WangLandauTmax",&WangLandauTmax);
+    config_lookup_int(cf,"WangLandauTstep",&WangLandauTstep);
+
+    config_lookup_bool(cf,"SaveSamples",&SaveSamples);
+    config_lookup_int(cf,"SamplesPerMegaStep",&SamplesPerMegaStep);
+    if (SamplesPerMegaStep<1)
+    {
+        fprintf(stderr,"SamplesPerMegaStep: %d; must be at least 1.\n",SamplesPerMegaStep);
+        exit(EXIT_FAILURE);
+    }
+
+    config_lookup_bool(cf,"LogEnergy",&LogEnergy);
+    config_lookup_int(cf,"EnergyCheckInterval",&EnergyCheckInterval);
+    config_lookup_bool(cf,"LogMoments",&LogMoments);
+
+    config_lookup_bool(cf,"AutoEquilibrate",&AutoEquilibrate);
+    config_lookup_int(cf,"MaxMCEqmSteps",&MaxMCEqmSteps);
+    config_lookup_int(cf,"MaxMCMegaSteps",&MaxMCMegaSteps);
+    config_lookup_int(cf,"TargetESS",&TargetESS);
 
     fprintf(stderr,"Finished loading config file. \n");
 }
@@ -0,0 +1,226 @@
+/* Starry Night - a Monte Carlo code to simulate ferroelectric domain formation
+ * and behaviour in hybrid perovskite solar cells.
+ *
+ * By Jarvist Moore Frost
+ * University of Bath
+ *
+ * File begun 16th January 2014
+ */
+
+// Dipole-dipole correlation functions, and the structure factor, for every
+// displacement (wavevector) at once. Correlations are by
+// Wiener-Khinchin: the lattice sum
+//   C_ab(r) = sum_x p_a(x) p_b(x+r)
+// is the inverse FFT of conj(p^_a) p^_b. Only the symmetrised
+// C_ab(r)+C_ba(r) is kept (it's all that the orientational correlations
+// need), i.e. 6 components xx,yy,zz,xy,xz,yz. O(N log N) in total, whatever
+// the cutoff.
+
+enum {CXX,CYY,CZZ,CXY,CXZ,CYZ};
+
+// Prototypes...
+static double complex ** correlation_transform();
+static double ** lattice_correlation();
+static double correlation_at(int c, int dx, int dy, int dz);
+static void structure_factor_sample();
+static void structure_factor_write(char * filename);
+
+double complex *orientation_transform[3]={NULL,NULL,NULL}; // p^_a(k), a=x,y,z
+unsigned long transform_version=ULONG_MAX;
+
+double *correlation[6]={NULL,NULL,NULL,NULL,NULL,NULL}; // flattened (x*Y+y)*Z+z
+unsigned long correlation_version=ULONG_MAX; // lattice_version it was computed at
+
+// p^_a(k) of the orientations (as dot() in the direct sums; not scaled by
+// length); shared by the correlation functions and S(q)
+static double complex ** correlation_transform()
+{
+    int a,i,x,y,z;
+    int sites=X*Y*Z;
+    double complex **p=orientation_transform;
+
+    if (p[0]==NULL)
+        for (a=0;a<3;a++) p[a]=(double complex *)malloc(sizeof(double complex)*sites);
+    if (transform_version==lattice_version) return(p);
+
+    for (x=0;x<X;x++)
+        for (y=0;y<Y;y++)
+            for (z=0;z<Z;z++)
+            {
+                i=(x*Y+y)*Z+z;
+                p[0][i]=lattice[x][y][z].x;
+                p[1][i]=lattice[x][y][z].y;
+                p[2][i]=lattice[x][y][z].z;
+            }
+    for (a=0;a<3;a++)
+        fft3d(p[a],X,Y,Z,FFT_FORWARD);
+
+    transform_version=lattice_version;
+    return(p);
+}
+
+// C_ab(r)+C_ba(r) for all r; cached against lattice_version
+static double ** lattice_correlation()
+{
+    int a,b,c,i;
+    int sites=X*Y*Z;
+    int pairs[6][2]={{0,0},{1,1},{2,2},{0,1},{0,2},{1,2}};
+    double complex **p, *C;
+
+    if (correlation[0]==NULL)
+        for (c=0;c<6;c++) correlation[c]=(double *)malloc(sizeof(double)*sites);
+    if (correlation_version==lattice_version) return(correlation);
+
+    p=correlation_transform();
+    C=(double complex *)malloc(sizeof(double complex)*sites);
+
+    for (c=0;c<6;c++)
+    {
+        a=pairs[c][0]; b=pairs[c][1];
+        for (i=0;i<sites;i++)
+            C[i]=2.0*creal(conj(p[a][i])*p[b][i]);
+        fft3d(C,X,Y,Z,FFT_INVERSE);
+        for (i=0;i<sites;i++)
+            correlation[c][i]=creal(C[i])/(double)sites;
+    }
+
+    free(C);
+    correlation_version=lattice_version;
+    return(correlation);
+}
+
+// Component c at any displacement; periodic images folded back into the cell
+static double correlation_at(int c, int dx, int dy, int dz)
+{
+    return(correlation[c][((((X+dx%X)%X)*Y + (Y+dy%Y)%Y)*Z + (Z+dz%Z)%Z)]);
+}
+
+// Polarisation structure factor S(q) = sum_a |p^_a(q)|^2 / N, for every q
+// of the lattice at once from the same transform. Accumulated over the
+// snapshots of a run (one per MC megastep), then written as one file:
+// coarsening curve, AFE zone boundary peaks, spherical and axis averages.
+struct
+{
+    int n; // snapshots
+    double *S; // sum of S(q) over snapshots
+    int size;
+    unsigned long *moves; // per snapshot: MC moves, domain length, S(0)
+    double *length, *S0;
+} sq;
+
+// Signed wavevector along an axis of length L, for FFT index k
+static double sq_wavevector(int k, int L)
+{
+    return(2.0*M_PI*(k<=L/2 ? k : k-L)/(double)L);
+}
+
+// Domain length from the first moment of S(q): L = 2 pi / <|q|>, q!=0
+static double sq_domain_length(double *S)
+{
+    int kx,ky,kz,i;
+    double qx,qy,qz,q,Sq=0.0,qSq=0.0;
+
+    for (kx=0;kx<X;kx++)
+        for (ky=0;ky<Y;ky++)
+            for (kz=0;kz<Z;kz++)
+            {
+                i=(kx*Y+ky)*Z+kz;
+                if (i==0) continue; // uniform polarisation, not domains
+                qx=sq_wavevector(kx,X); qy=sq_wavevector(ky,Y); qz=sq_wavevector(kz,Z);
+                q=sqrt(qx*qx+qy*qy+qz*qz);
+                Sq+=S[i];
+                qSq+=q*S[i];
+            }
+    return(qSq>0.0 ? 2.0*M_PI*Sq/qSq : 0.0);
+}
+
+static void structure_factor_sample()
+{
+    int i;
+    int sites=X*Y*Z;
+    double complex **p=correlation_transform();
+    double *S=(double *)malloc(sizeof(double)*sites);
+
+    if (sq.S==NULL) sq.S=(double *)calloc(sites,sizeof(double));
+    if (sq.n==sq.size) // grow
+    {
+        sq.size=sq.size ? 2*sq.size : 64;
+        sq.moves=(unsigned long *)realloc(sq.moves,sizeof(unsigned long)*sq.size);
+        sq.length=(double *)realloc(sq.length,sizeof(double)*sq.size);
+        sq.S0=(double *)realloc(sq.S0,sizeof(double)*sq.size);
+    }
+
+    for (i=0;i<sites;i++)
+    {
+        S[i]=(creal(p[0][i]*conj(p[0][i])) + creal(p[1][i]*conj(p[1][i])) + creal(p[2][i]*conj(p[2][i])))/(double)sites;
+        sq.S[i]+=S[i];
+    }
+    sq.moves[sq.n]=ACCEPT+REJECT;
+    sq.length[sq.n]=sq_domain_length(S);
+    sq.S0[sq.n]=S[0];
+    sq.n++;
+
+    free(S);
+}
+
+static void structure_factor_write(char * filename)
+{
+    int kx,ky,kz,i,bin,nbins;
+    int sites=X*Y*Z;
+    int L=X>Y ? (X>Z ? X : Z) : (Y>Z ? Y : Z);
+    double qx,qy,qz,q,dq=2.0*M_PI/L;
+    double *S, *shell;
+    int *count;
+    FILE *fo;
+
+    if (sq.n==0) return;
+
+    S=(double *)malloc(sizeof(double)*sites);
+    for (i=0;i<sites;i++) S[i]=sq.S[i]/sq.n;
+
+    fo=fopen(filename,"w");
+    fprintf(fo,"# Structure factor S(q)=|p(q)|^2/N; T: %d lattice: %d %d %d snapshots: %d CageStrain: %f\n",
+            T,X,Y,Z,sq.n,CageStrain);
+    fprintf(fo,"# Domain length (2pi/<|q|>, q!=0) of <S(q)>: %f\n",sq_domain_length(S));
+
+    // AFE order shows up on the zone boundary; nearest k to pi on odd axes
+#define SQ(kx,ky,kz) S[((kx)*Y+(ky))*Z+(kz)]
+    fprintf(fo,"# S(0): %f S(pi,0,0): %f S(0,pi,0): %f S(0,0,pi): %f S(pi,pi,0): %f S(pi,0,pi): %f S(0,pi,pi): %f S(pi,pi,pi): %f\n",
+            SQ(0,0,0),SQ(X/2,0,0),SQ(0,Y/2,0),SQ(0,0,Z/2),
+            SQ(X/2,Y/2,0),SQ(X/2,0,Z/2),SQ(0,Y/2,Z/2),SQ(X/2,Y/2,Z/2));
+
+    fprintf(fo,"\n# Coarsening: moves domain_length S(0)\n");
+    for (i=0;i<sq.n;i++)
+        fprintf(fo,"%lu %f %f\n",sq.moves[i],sq.length[i],sq.S0[i]);
+
+    // Spherical average in shells of width 2pi/L
+    nbins=(int)(sqrt(3.0)*M_PI/dq)+2;
+    shell=(double *)calloc(nbins,sizeof(double));
+    count=(int *)calloc(nbins,sizeof(int));
+    for (kx=0;kx<X;kx++)
+        for (ky=0;ky<Y;ky++)
+            for (kz=0;kz<Z;kz++)
+            {
+                qx=sq_wavevector(kx,X); qy=sq_wavevector(ky,Y); qz=sq_wavevector(kz,Z);
+                q=sqrt(qx*qx+qy*qy+qz*qz);
+                bin=(int)(q/dq+0.5);
+                shell[bin]+=SQ(kx,ky,kz);
+                count[bin]++;
+            }
+    fprintf(fo,"\n\n# Spherical average: |q| S(|q|) modes\n");
+    for (bin=0;bin<nbins;bin++)
+        if (count[bin]>0)
+            fprintf(fo,"%f %f %d\n",bin*dq,shell[bin]/count[bin],count[bin]);
+
+    // Along each axis; S(q)=S(-q) for a real field, so q>=0 only
+    fprintf(fo,"\n\n# Axis resolved: q S(q,0,0)\n");
+    for (kx=0;kx<=X/2;kx++) fprintf(fo,"%f %f\n",sq_wavevector(kx,X),SQ(kx,0,0));
+    fprintf(fo,"\n\n# Axis resolved: q S(0,q,0)\n");
+    for (ky=0;ky<=Y/2;ky++) fprintf(fo,"%f %f\n",sq_wavevector(ky,Y),SQ(0,ky,0));
+    fprintf(fo,"\n\n# Axis resolved: q S(0,0,q)\n");
+    for (kz=0;kz<=Z/2;kz++) fprintf(fo,"%f %f\n",sq_wavevector(kz,Z),SQ(0,0,kz));
+#undef SQ
+
+    fclose(fo);
+    free(S); free(shell); free(count);
+}
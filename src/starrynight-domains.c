@@ -0,0 +1,237 @@
+/* Starry Night - a Monte Carlo code to simulate ferroelectric domain formation
+ * and behaviour in hybrid perovskite solar cells.
+ *
+ * By Jarvist Moore Frost
+ * University of Bath
+ *
+ * File begun 16th January 2014
+ */
+
+// Ferroelectric domains as connected clusters of similarly oriented dipoles.
+// Nearest neighbours (periodic) are bonded if their orientations are within
+// DomainAngle degrees, or with ConstrainToX if they point the same way along
+// x. Empty sites (zero dipole) belong to no domain.
+//
+// Labelling is union-find (Hoshen-Kopelman by another name) over a flat
+// parent array. Each thread links its own slab of x-planes, so never touches
+// another's sites; the slabs are then stitched together serially across their
+// Y*Z boundary planes, and the trees flattened in parallel.
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+// Prototypes...
+static int domain_empty(struct dipole *a);
+static int domain_bonded(struct dipole *a, struct dipole *b);
+static int domain_find(int *parent, int i);
+static void domain_union(int *parent, int i, int j);
+static int lattice_domains();
+static void domains_log(char * filename);
+static void domains_binary(char * filename);
+
+int *domain=NULL; // compact cluster label of every site, flattened (x*Y+y)*Z+z; -1 empty
+int domain_count=0;
+struct domain_stats
+{
+    int size;
+    double px,py,pz; // sum of orientations
+} *domains=NULL; // per cluster, indexed by label
+unsigned long domain_version=ULONG_MAX; // lattice_version it was computed at
+double domain_cos=1.0; // cos(DomainAngle)
+
+static int domain_empty(struct dipole *a)
+{
+    return(a->length==0.0 || (a->x==0.0 && a->y==0.0 && a->z==0.0));
+}
+
+static int domain_bonded(struct dipole *a, struct dipole *b)
+{
+    if (domain_empty(a) || domain_empty(b)) return(false);
+    if (ConstrainToX) return(a->x*b->x > 0.0);
+    return(dot(a,b) >= domain_cos);
+}
+
+// Root of i, halving the path as we go
+static int domain_find(int *parent, int i)
+{
+    while (parent[i]!=i)
+    {
+        parent[i]=parent[parent[i]];
+        i=parent[i];
+    }
+    return(i);
+}
+
+// Link the two trees under the lower root, so labels are stable in site order
+static void domain_union(int *parent, int i, int j)
+{
+    i=domain_find(parent,i);
+    j=domain_find(parent,j);
+    if (i<j) parent[j]=i;
+    else if (j<i) parent[i]=j;
+}
+
+#define SITE(x,y,z) (((x)*Y+(y))*Z+(z))
+
+// Label every site with its cluster; cached against lattice_version.
+// Returns the number of clusters.
+static int lattice_domains()
+{
+    int i,t,x,y,z,nthreads=1;
+    int sites=X*Y*Z;
+    int *parent;
+
+    if (domain==NULL) domain=(int *)malloc(sizeof(int)*sites);
+    if (domain_version==lattice_version) return(domain_count);
+    parent=domain; // labels are built in place over the parent array
+    domain_cos=cos(DomainAngle*M_PI/180.0);
+
+#pragma omp parallel private(i,x,y,z)
+    {
+        int t=0,x0,x1;
+#ifdef _OPENMP
+        t=omp_get_thread_num();
+#pragma omp single
+        nthreads=omp_get_num_threads();
+#endif
+        // contiguous slab of x-planes for this thread
+        x0=(t*X)/nthreads; x1=((t+1)*X)/nthreads;
+
+        for (i=SITE(x0,0,0);i<SITE(x1,0,0);i++) parent[i]=i;
+        for (x=x0;x<x1;x++)
+            for (y=0;y<Y;y++)
+                for (z=0;z<Z;z++)
+                {
+                    i=SITE(x,y,z);
+                    if (x+1<x1 && domain_bonded(&lattice[x][y][z],&lattice[x+1][y][z]))
+                        domain_union(parent,i,SITE(x+1,y,z));
+                    if (Y>1 && domain_bonded(&lattice[x][y][z],&lattice[x][(y+1)%Y][z]))
+                        domain_union(parent,i,SITE(x,(y+1)%Y,z));
+                    if (Z>1 && domain_bonded(&lattice[x][y][z],&lattice[x][y][(z+1)%Z]))
+                        domain_union(parent,i,SITE(x,y,(z+1)%Z));
+                }
+    }
+
+    // Stitch the slabs together, including the periodic wrap in x
+    if (X>1)
+        for (t=0;t<nthreads;t++)
+        {
+            x=((t+1)*X)/nthreads-1; // last plane of slab t
+            if (x<(t*X)/nthreads) continue; // empty slab
+            for (y=0;y<Y;y++)
+                for (z=0;z<Z;z++)
+                    if (domain_bonded(&lattice[x][y][z],&lattice[(x+1)%X][y][z]))
+                        domain_union(parent,SITE(x,y,z),SITE((x+1)%X,y,z));
+        }
+
+    // Point every site straight at its root
+#pragma omp parallel for private(i)
+    for (i=0;i<sites;i++)
+    {
+        int r=i;
+        while (parent[r]!=r) r=parent[r];
+        parent[i]=r; // a race only ever replaces an ancestor with the root
+    }
+
+    // Compact labels: 0,1,2... in order of each cluster's first site. Roots
+    // are the lowest site of their cluster, so this sweep relabels each root
+    // before any site that points at it.
+    domain_count=0;
+    for (i=0;i<sites;i++)
+    {
+        x=i/(Y*Z); y=(i/Z)%Y; z=i%Z;
+        if (domain_empty(&lattice[x][y][z]))
+            domain[i]=-1;
+        else if (parent[i]==i)
+            domain[i]=domain_count++;
+        else
+            domain[i]=domain[parent[i]];
+    }
+
+    domains=(struct domain_stats *)realloc(domains,sizeof(struct domain_stats)*(domain_count>0 ? domain_count : 1));
+    for (i=0;i<domain_count;i++)
+    {
+        domains[i].size=0;
+        domains[i].px=0.0; domains[i].py=0.0; domains[i].pz=0.0;
+    }
+    for (x=0;x<X;x++)
+        for (y=0;y<Y;y++)
+            for (z=0;z<Z;z++)
+            {
+                i=domain[SITE(x,y,z)];
+                if (i<0) continue;
+                domains[i].size++;
+                domains[i].px+=lattice[x][y][z].x;
+                domains[i].py+=lattice[x][y][z].y;
+                domains[i].pz+=lattice[x][y][z].z;
+            }
+
+    domain_version=lattice_version;
+    return(domain_count);
+}
+
+#undef SITE
+
+static int domain_size_descending(const void *a, const void *b)
+{
+    return(((struct domain_stats *)b)->size - ((struct domain_stats *)a)->size);
+}
+
+// Appends one block per call: totals, size histogram in powers of two, and
+// the mean polarisation of every cluster of at least DomainMinSize sites
+static void domains_log(char * filename)
+{
+    int i,bin,largest=0,n;
+    int sites=X*Y*Z;
+    int histogram[32];
+    double weighted=0.0,p;
+    struct domain_stats *sorted;
+    FILE *fo;
+
+    n=lattice_domains();
+
+    for (bin=0;bin<32;bin++) histogram[bin]=0;
+    for (i=0;i<n;i++)
+    {
+        if (domains[i].size>largest) largest=domains[i].size;
+        weighted+=(double)domains[i].size*domains[i].size;
+        for (bin=0;bin<30 && (2<<bin)<=domains[i].size;bin++);
+        histogram[bin]++;
+    }
+
+    fo=fopen(filename,"a"); // Open in append mode. If filename doesn't exist, it is created.
+    fprintf(fo,"# moves: %lu clusters: %d largest_fraction: %f weighted_mean_size: %f DomainAngle: %f\n",
+            ACCEPT+REJECT,n,(double)largest/sites,weighted/sites,DomainAngle);
+
+    fprintf(fo,"# size_from count\n");
+    for (bin=0;bin<32;bin++)
+        if (histogram[bin]>0) fprintf(fo,"%d %d\n",1<<bin,histogram[bin]);
+
+    fprintf(fo,"# size px py pz |p| (per site; clusters of %d sites or more)\n",DomainMinSize);
+    sorted=(struct domain_stats *)malloc(sizeof(struct domain_stats)*(n>0 ? n : 1));
+    memcpy(sorted,domains,sizeof(struct domain_stats)*n);
+    qsort(sorted,n,sizeof(struct domain_stats),domain_size_descending);
+    for (i=0;i<n && sorted[i].size>=DomainMinSize;i++)
+    {
+        p=sqrt(sorted[i].px*sorted[i].px+sorted[i].py*sorted[i].py+sorted[i].pz*sorted[i].pz)/sorted[i].size;
+        fprintf(fo,"%d %f %f %f %f\n",sorted[i].size,
+                sorted[i].px/sorted[i].size,sorted[i].py/sorted[i].size,sorted[i].pz/sorted[i].size,p);
+    }
+    fprintf(fo,"\n\n");
+
+    free(sorted);
+    fclose(fo);
+}
+
+// Label volume; raw int32 per site in [X][Y][Z] order, -1 for empty sites
+static void domains_binary(char * filename)
+{
+    FILE *fo;
+
+    lattice_domains();
+
+    fo=fopen(filename,"wb");
+    fwrite(domain,sizeof(int),X*Y*Z,fo);
+    fclose(fo);
+}
@@ -0,0 +1,150 @@
+/* Starry Night - a Monte Carlo code to simulate ferroelectric domain formation
+ * and behaviour in hybrid perovskite solar cells.
+ *
+ * By Jarvist Moore Frost
+ * University of Bath
+ *
+ * File begun 16th January 2014
+ */
+
+// Vector electric field of the dipole lattice, on the site lattice and on the
+// dual (half-offset) lattice, in one pass. The dipole field
+//   E_a(x) = sum_r T_ab(r) p_b(x+r),   T_ab(r) = (3 n_a n_b - delta_ab)/|r|^3
+// is a correlation with a tensor kernel, so (as the potential) is done by FFT:
+// three forward transforms of p, then three inverse per lattice.
+//
+// Kernels are the direct sums over a site stencil (cutoff 4, plus the -p/3
+// contact term) and an offset stencil (cutoff 2, field points offset by half
+// a lattice vector, at x-(1/2,1/2,1/2)).
+
+struct field
+{
+    double *x,*y,*z;
+} efield_site, efield_offset; // flattened (x*Y+y)*Z+z
+
+// Prototypes...
+static void efield_kernel_init();
+static void efield_kernel_add(double complex *T[6], struct sphere *s);
+static void lattice_efield();
+static void lattice_Efield_binary(char * filename, struct field *E);
+
+double complex *efield_kernel[2][6]; // conj(T^_ab)/N; [0] site, [1] offset lattice
+unsigned long efield_version=ULONG_MAX; // lattice_version it was computed at
+
+// Dipole tensor of each displacement of the stencil, folded into the
+// periodic cell; the self term (T zero) adds nothing
+static void efield_kernel_add(double complex *T[6], struct sphere *s)
+{
+    int c,j,i;
+
+    for (j=0;j<s->n;j++)
+    {
+        i=((((X+s->dx[j]%X)%X)*Y + (Y+s->dy[j]%Y)%Y)*Z + (Z+s->dz[j]%Z)%Z);
+        for (c=0;c<6;c++) T[c][i]+=s->T[c][j];
+    }
+}
+
+static void efield_kernel_init()
+{
+    int l,c,i;
+    int sites=X*Y*Z;
+    const int CUTOFF=4, OFFSETCUTOFF=2;
+
+    for (l=0;l<2;l++)
+        for (c=0;c<6;c++)
+            efield_kernel[l][c]=(double complex *)calloc(sites,sizeof(double complex));
+
+    // Site lattice
+    efield_kernel_add(efield_kernel[0],sphere_stencil(CUTOFF,STENCIL_SITE));
+    // Kronecker delta contribution from dipole at distance=0
+    efield_kernel[0][TXX][0]-=1/3.0;
+    efield_kernel[0][TYY][0]-=1/3.0;
+    efield_kernel[0][TZZ][0]-=1/3.0;
+
+    // Offset lattice; no dipole is ever at distance 0
+    efield_kernel_add(efield_kernel[1],sphere_stencil(OFFSETCUTOFF,STENCIL_OFFSET));
+
+    for (l=0;l<2;l++)
+        for (c=0;c<6;c++)
+        {
+            fft3d(efield_kernel[l][c],X,Y,Z,FFT_FORWARD);
+            for (i=0;i<sites;i++)
+                efield_kernel[l][c][i]=conj(efield_kernel[l][c][i])/(double)sites;
+        }
+
+    for (l=0;l<2;l++)
+    {
+        struct field *E= l==0 ? &efield_site : &efield_offset;
+        E->x=(double *)malloc(sizeof(double)*sites);
+        E->y=(double *)malloc(sizeof(double)*sites);
+        E->z=(double *)malloc(sizeof(double)*sites);
+    }
+}
+
+// Fills efield_site and efield_offset; cached against lattice_version
+static void lattice_efield()
+{
+    int a,l,i,x,y,z;
+    int sites=X*Y*Z;
+    double complex *p[3], *E;
+    double *out;
+    int T3[3][3]={{TXX,TXY,TXZ},{TXY,TYY,TYZ},{TXZ,TYZ,TZZ}};
+
+    if (efield_site.x==NULL) efield_kernel_init();
+    if (efield_version==lattice_version) return;
+
+    for (a=0;a<3;a++)
+        p[a]=(double complex *)malloc(sizeof(double complex)*sites);
+    E=(double complex *)malloc(sizeof(double complex)*sites);
+
+    // orientations, as the direct sums
+    for (x=0;x<X;x++)
+        for (y=0;y<Y;y++)
+            for (z=0;z<Z;z++)
+            {
+                i=(x*Y+y)*Z+z;
+                p[0][i]=lattice[x][y][z].x;
+                p[1][i]=lattice[x][y][z].y;
+                p[2][i]=lattice[x][y][z].z;
+            }
+    for (a=0;a<3;a++)
+        fft3d(p[a],X,Y,Z,FFT_FORWARD);
+
+    for (l=0;l<2;l++)
+        for (a=0;a<3;a++)
+        {
+            for (i=0;i<sites;i++)
+                E[i]=efield_kernel[l][T3[a][0]][i]*p[0][i]
+                    +efield_kernel[l][T3[a][1]][i]*p[1][i]
+                    +efield_kernel[l][T3[a][2]][i]*p[2][i];
+            fft3d(E,X,Y,Z,FFT_INVERSE);
+
+            struct field *F= l==0 ? &efield_site : &efield_offset;
+            out= a==0 ? F->x : a==1 ? F->y : F->z;
+            for (i=0;i<sites;i++) out[i]=creal(E[i]);
+        }
+
+    for (a=0;a<3;a++) free(p[a]);
+    free(E);
+    efield_version=lattice_version;
+}
+
+// Binary vector field: float32 (Ex,Ey,Ez) per site, sites in C order
+// [X][Y][Z], native byte order; no header
+static void lattice_Efield_binary(char * filename, struct field *E)
+{
+    int i;
+    int sites=X*Y*Z;
+    float v[3];
+    FILE *fo;
+
+    lattice_efield();
+
+    fo=fopen(filename,"wb");
+    for (i=0;i<sites;i++)
+    {
+        v[0]=E->x[i]; v[1]=E->y[i]; v[2]=E->z[i];
+        fwrite(v,sizeof(float),3,fo);
+    }
+    fclose(fo);
+}
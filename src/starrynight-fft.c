@@ -0,0 +1,144 @@
+/* Starry Night - a Monte Carlo code to simulate ferroelectric domain formation
+ * and behaviour in hybrid perovskite solar cells.
+ *
+ * By Jarvist Moore Frost
+ * University of Bath
+ *
+ * File begun 16th January 2014
+ */
+
+// Small self contained complex FFT, so we don't pick up a dependency on FFTW.
+// Mixed radix Cooley-Tukey (decimation in time) in the style of KISS FFT:
+// any length factors into primes, each stage a generic radix-p butterfly. That
+// is O(n sum(p)) rather than O(n log n) for large prime factors, but lattice
+// dimensions are small and composite in practice.
+//
+// fft3d() transforms a whole X*Y*Z lattice (flattened (x*Y+y)*Z+z, as
+// elsewhere) in place, a line at a time along each axis.
+
+#include <complex.h>
+
+#define FFT_FORWARD -1
+#define FFT_INVERSE +1 // unnormalised; divide by n yourself
+
+struct fft_plan
+{
+    int n;
+    int factors[64]; // pairs of (radix p, remaining length m)
+    double complex *twiddles;
+};
+
+// Prototypes...
+static struct fft_plan * fft_plan_create(int n, int sign);
+static void fft_plan_destroy(struct fft_plan *plan);
+static void fft_exec(struct fft_plan *plan, const double complex *in, double complex *out);
+static void fft_work(double complex *out, const double complex *in, int fstride, int *factors, struct fft_plan *plan);
+static void fft3d(double complex *data, int nx, int ny, int nz, int sign);
+
+static struct fft_plan * fft_plan_create(int n, int sign)
+{
+    int i,p=2,m=n;
+    struct fft_plan *plan=(struct fft_plan *)malloc(sizeof(struct fft_plan));
+
+    plan->n=n;
+    plan->twiddles=(double complex *)malloc(sizeof(double complex)*n);
+    for (i=0;i<n;i++)
+        plan->twiddles[i]=cexp(sign*2.0*M_PI*I*(double)i/(double)n);
+
+    // factorise into primes, smallest first
+    i=0;
+    do
+    {
+        while (m%p) p++;
+        m/=p;
+        plan->factors[i++]=p;
+        plan->factors[i++]=m;
+    } while (m>1);
+
+    return(plan);
+}
+
+static void fft_plan_destroy(struct fft_plan *plan)
+{
+    free(plan->twiddles);
+    free(plan);
+}
+
+// out[] = DFT of in[]; must not overlap
+static void fft_exec(struct fft_plan *plan, const double complex *in, double complex *out)
+{
+    if (plan->n==1) { out[0]=in[0]; return; }
+    fft_work(out,in,1,plan->factors,plan);
+}
+
+// Recursive stage: p sub-transforms of length m (of every p'th input), then
+// recombine with radix-p butterflies.
+static void fft_work(double complex *out, const double complex *in, int fstride, int *factors, struct fft_plan *plan)
+{
+    int p=factors[0], m=factors[1];
+    int k,u,q,q1,twidx;
+    double complex scratch[p], acc;
+
+    if (m==1)
+        for (k=0;k<p;k++) out[k]=in[k*fstride];
+    else
+        for (k=0;k<p;k++) fft_work(out+k*m,in+k*fstride,fstride*p,factors+2,plan);
+
+    for (u=0;u<m;u++)
+    {
+        for (q1=0;q1<p;q1++) scratch[q1]=out[u+q1*m];
+
+        for (q1=0;q1<p;q1++)
+        {
+            k=u+q1*m;
+            acc=scratch[0];
+            twidx=0;
+            for (q=1;q<p;q++)
+            {
+                twidx+=fstride*k;
+                twidx%=plan->n;
+                acc+=scratch[q]*plan->twiddles[twidx];
+            }
+            out[k]=acc;
+        }
+    }
+}
+
+// In place 3D transform of data[(x*ny+y)*nz+z]. Lines along each axis are
+// independent, so are shared out over OpenMP threads.
+static void fft3d(double complex *data, int nx, int ny, int nz, int sign)
+{
+    int axis;
+    int n[3]={nx,ny,nz};
+    int stride[3]={ny*nz,nz,1};
+
+    for (axis=0;axis<3;axis++)
+    {
+        int len=n[axis], s=stride[axis];
+        int lines=nx*ny*nz/len;
+        int line;
+        struct fft_plan *plan;
+
+        if (len==1) continue;
+        plan=fft_plan_create(len,sign);
+
+#pragma omp parallel
+        {
+            int i,base;
+            double complex *in=(double complex *)malloc(sizeof(double complex)*len);
+            double complex *out=(double complex *)malloc(sizeof(double complex)*len);
+
+#pragma omp for
+            for (line=0;line<lines;line++)
+            {
+                // first element of this line: the index with the axis digit zeroed
+                base=(line/s)*s*len + line%s;
+                for (i=0;i<len;i++) in[i]=data[base+i*s];
+                fft_exec(plan,in,out);
+                for (i=0;i<len;i++) data[base+i*s]=out[i];
+            }
+            free(in); free(out);
+        }
+        fft_plan_destroy(plan);
+    }
+}
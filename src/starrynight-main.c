@@ -22,14 +22,35 @@ static int rand_int(int SPAN);
 
 #include "starrynight-config.c" //Global variables & config file reader function  
 #include "starrynight-lattice.c" //Lattice initialisation / zeroing / sphere picker fn; dot product
+#include "starrynight-stencils.c" // Spherical stencils, built once, shared
+#include "starrynight-fft.c" // Mixed radix FFT
+#include "starrynight-potential.c" // Whole lattice electrostatic potential by FFT
+#include "starrynight-correlation.c" // Dipole correlation functions by FFT
+#include "starrynight-efield.c" // Vector electric field, site + offset lattices, by FFT
+#include "starrynight-domains.c" // Domain (cluster) labelling by union-find
+#include "starrynight-walls.c" // Incremental domain wall tracking
+#include "starrynight-orientation.c" // Orientation distribution on the sphere
+#include "starrynight-trajectory.c" // Binary trajectory, delta encoded + indexed
+#include "starrynight-octahedral.c" // Quantised (octahedral) snapshots
+#include "starrynight-arrays.c" // Volumetric outputs as .npy / raw arrays
+#include "starrynight-textout.c" // Buffered, parallel text output
+#include "starrynight-png.c" // PNG encoder
+#include "starrynight-terminal.c" // Terminal display: composed frames, redrawn where changed
+#include "starrynight-scheduler.c" // Cadence + cost budgets of the outputs
+#include "starrynight-pipeline.c" // Asynchronous analysis, in forked snapshots
 #include "starrynight-analysis.c" //Analysis functions, and output routines
+#include "starrynight-video.c" // Live video stream of the lattice
+#include "starrynight-autocorrelation.c" // Equilibration detection, autocorrelation times
 #include "starrynight-montecarlo-core.c" // Core simulation
+#include "starrynight-wanglandau.c" // Density of states / multicanonical sampling
 
 // this analysis function run before MC moves start.
 void analysis_initial()
 {
     if(CalculateEfield) lattice_Efield_XYZ("initial_lattice_efield.xyz");
     if(CalculateEfield) lattice_Efieldoffset_XYZ("initial_lattice_efieldoffset.xyz");
+    if(SaveEfieldBinary) lattice_Efield_binary("initial_lattice_efield.bin",&efield_site);
+    if(SaveEfieldBinary) lattice_Efield_binary("initial_lattice_efieldoffset.bin",&efield_offset);
     if(CalculatePotential) lattice_potential_XYZ("initial_lattice_potential.xyz"); // potential distro
     if(SavePotentialCube) lattice_potential_cube("initial_lattice_potential.cube");
     if(SaveDipolesSVG) outputlattice_svg("initial-SVG.svg");
@@ -48,29 +69,50 @@ void analysis_initial()
 }
 
 // this analysis function run every MEGASTEPS, for intermediate data collection
+// Anything here changes (or accumulates) simulation state, so is done in line;
+// the output routines follow in analysis_outputs(), possibly asynchronously.
 void analysis_midpoint(int MCstep, FILE *log)
 {
-    char name[100],prefix[100]; 
-
     // FIXME: JMF 2017-10 - this commented out code should either be made .cfg
     // options, or deleted.
 
-    // Log some data... Nb: Slow as does a NxN summation of lattice energy
-    // contributions!
+    // Log some data... Energies are the running totals, so this is free
     //        lattice_potential_log(log);
-    //fprintf(log,"%lu %f %f %f\n",ACCEPT+REJECT,lattice_energy(),Efield,Eangle); //FIXME: lattice_energy all broken, data worthless presently.
-    // TODO: some kind of dipole distribution? Would I have to bin it
-    // myself? (boring.)
-    // TODO: Split Energy into different contributions... would be nice to
-    // see polarisation delta.E spike when the field flips
+    if (LogEnergy)
+        fprintf(log,"%lu E: %f dipole: %f strain: %f field: %f K: %f\n",
+                ACCEPT+REJECT,Etotal,Eterms.dipole,Eterms.strain,Eterms.field,Eterms.K);
+    if (LogMoments) moments_log(log);
+    if (EnergyCheckInterval>0 && MCstep%EnergyCheckInterval==EnergyCheckInterval-1)
+        energy_check(log);
+    if(CalculateStructureFactor) structure_factor_sample(); // written at the end of the run
+
+    schedule_plan(); // which outputs are due
+    analysis_snapshot(MCstep,log);
+}
+
+// Output routines of each MEGASTEP; read only, so safe on a snapshot. Each
+// runs only when the scheduler has it due.
+void analysis_outputs(int MCstep, FILE *log)
+{
+    char name[100],prefix[32]; // prefix: "T_%04d_i_%03d", at most 27 chars
+
+    sprintf(name,"Orientations_T_%04d.dat",T);
+    if (CalculateOrientations && schedule_start(OBS_ORIENTATIONS))
+        { orientations_log(name); schedule_stop(OBS_ORIENTATIONS); } // appends to file; kept current by MC_accept()
 
     // Update the (interactive) user what we're up to
     //fprintf(stderr,".");
     //fprintf(stderr,"\n");
-    if(DisplayDumbTerminal) outputlattice_dumb_terminal(); //Party like it's 1980
-    if(CalculateRecombination) recombination_calculator(log);
+    if(DisplayDumbTerminal && schedule_start(OBS_TERMINAL))
+        { outputlattice_dumb_terminal(); schedule_stop(OBS_TERMINAL); } //Party like it's 1980
+    if(CalculateRecombination && schedule_start(OBS_RECOMBINATION))
+        { recombination_calculator(log); schedule_stop(OBS_RECOMBINATION); }
     sprintf(name,"RDF-%.4d.dat",T);
-    if(CalculateRadialOrderParameter) radial_order_parameter(name); // appends to file 
+    if(CalculateRadialOrderParameter && schedule_start(OBS_RDF))
+        { radial_order_parameter(name); schedule_stop(OBS_RDF); } // appends to file 
+    sprintf(name,"Domains_T_%04d.dat",T);
+    if(CalculateDomains && schedule_start(OBS_DOMAINS))
+        { domains_log(name); schedule_stop(OBS_DOMAINS); } // appends to file
 
     //fprintf(stderr,"Efield: x %f y %f z %f | Dipole %f CageStrain %f K %f\n",Efield.x,Efield.y,Efield.z,Dipole,CageStrain,K);
     //            fprintf(stderr,"dipole_fraction: %f T: %d Landau: %f\n",dipole_fraction,T,landau_order());
@@ -81,29 +123,58 @@ void analysis_midpoint(int MCstep, FILE *log)
 
     sprintf(prefix,"T_%04d_i_%03d",T,MCstep); // ie. T_0300_t_002 - for batch runs
 
-    sprintf(name,"%s_efield.xyz",prefix);
-    if(CalculateEfield) lattice_Efield_XYZ(name);
+    if((CalculateEfield || SaveEfieldBinary) && schedule_start(OBS_EFIELD))
+    {
+        sprintf(name,"%s_efield.xyz",prefix);
+        if(CalculateEfield) lattice_Efield_XYZ(name);
+
+        snprintf(name,sizeof name,"%s_efield.bin",prefix);
+        if(SaveEfieldBinary) lattice_Efield_binary(name,&efield_site);
+        snprintf(name,sizeof name,"%s_efieldoffset.bin",prefix);
+        if(SaveEfieldBinary) lattice_Efield_binary(name,&efield_offset);
+        schedule_stop(OBS_EFIELD);
+    }
+
+    snprintf(name,sizeof name,"%s_domains.bin",prefix);
+    if(SaveDomainLabels && schedule_start(OBS_DOMAINLABELS))
+        { domains_binary(name); schedule_stop(OBS_DOMAINLABELS); }
 
     sprintf(name,"%s_potential.xyz",prefix);
-    if(CalculatePotential) lattice_potential_XYZ(name); // potential distro; text format (3D)
+    if(CalculatePotential && schedule_start(OBS_POTENTIALXYZ))
+        { lattice_potential_XYZ(name); schedule_stop(OBS_POTENTIALXYZ); } // potential distro; text format (3D)
 
     sprintf(name,"%s_potential.cube",prefix);
-    if(SavePotentialCube) lattice_potential_cube(name);
+    if(SavePotentialCube && schedule_start(OBS_POTENTIALCUBE))
+        { lattice_potential_cube(name); schedule_stop(OBS_POTENTIALCUBE); }
  
     sprintf(name,"%s_potential.png",prefix);
-    if(CalculatePotential) outputpotential_png(name); // 'surface of the moon' picture (2D)
+    if(CalculatePotential && schedule_start(OBS_POTENTIALPNG))
+        { outputpotential_png(name); schedule_stop(OBS_POTENTIALPNG); } // 'surface of the moon' picture (2D)
 
     sprintf(name,"%s_MC-PNG_final.png",prefix); 
-    if(SaveDipolesPNG) outputlattice_ppm_hsv(name); // coloured squares (2D)
+    if(SaveDipolesPNG && schedule_start(OBS_DIPOLESPNG))
+        { outputlattice_ppm_hsv(name); schedule_stop(OBS_DIPOLESPNG); } // coloured squares (2D)
 
     sprintf(name,"%s_MC-SVG_final.svg",prefix);
-    if(SaveDipolesSVG) outputlattice_svg(name); // arrows (2D)
+    if(SaveDipolesSVG && schedule_start(OBS_DIPOLESSVG))
+        { outputlattice_svg(name); schedule_stop(OBS_DIPOLESSVG); } // arrows (2D)
 
+    snprintf(name,sizeof name,"%s_dipoles.oct",prefix);
+    if(SaveDipolesOctahedral && schedule_start(OBS_DIPOLESOCTAHEDRAL))
+        { lattice_octahedral(name); schedule_stop(OBS_DIPOLESOCTAHEDRAL); } // compact snapshot
+
+    if(SaveArrays && schedule_start(OBS_ARRAYS))
+        { arrays_write(prefix); schedule_stop(OBS_ARRAYS); } // .npy / raw, for mmap()
 }
 
 // this analysis function runs at simulation end
 void analysis_final()
 {
+    char name[100];
+
+    sprintf(name,"StructureFactor_T_%04d.dat",T);
+    if(CalculateStructureFactor) structure_factor_write(name); // averaged over the run
+
     // FIXME: JMF 2017-10 - Either delete commented code or make a config option!
 
     // Final data output / summaries.
@@ -125,6 +196,7 @@ int main(int argc, char *argv[])
 {
     int i,j,k, x,y; // for loop iterators
     int tic,toc,tac;    // keep track of time for user interface; how many MC moves per second
+    FILE *samples=NULL; // (E,P,Landau) sample stream for histogram reweighting
 
     char name[100],prefix[100]; 
     char const *LOGFILE = NULL; //for output filenames
@@ -203,6 +275,27 @@ int main(int argc, char *argv[])
     fprintf(stderr,"Lattice initialised...");
     solid_solution(); //populate dipole strengths on top of this
     fprintf(stderr,"Solid solution formed...\n");
+    lattice_version++;
+    if (QuantiseDipoles) lattice_quantise(); // on the octahedral grid from here on
+
+    Etotal=lattice_energy(&Eterms); // seed running totals; MC_accept() keeps them current
+    lattice_dipole_sum();
+    if (IncrementalPotential) lattice_potential(); // ...and from now on kept current by MC_accept()
+    if (CalculateOrientations) lattice_orientations(); // also kept current by MC_accept()
+    sprintf(name,"Trajectory_T_%04d.traj",T);
+    if (SaveTrajectory) trajectory_open(name); // changed sites flagged by MC_accept()
+    if (VideoStream) video_open();
+    if (TrackWalls)
+    {
+        lattice_walls(); // also kept current by MC_accept()
+        sprintf(name,"Walls_T_%04d.dat",T);
+        wallslog=fopen(name,"w");
+        fprintf(wallslog,"# Walls T: %d WallThreshold: %f WallAntiparallel: %d WallOrigin: %f\n",
+                T,WallThreshold,WallAntiparallel,WallOrigin);
+        fprintf(wallslog,"# moves area area/YZ mean_x rms_x velocity(per sweep)\n");
+    }
+    fprintf(stderr,"Initial lattice energy: %f (dipole %f strain %f field %f K %f)\n",
+            Etotal,Eterms.dipole,Eterms.strain,Eterms.field,Eterms.K);
 
     if(DisplayDumbTerminal) outputlattice_dumb_terminal(); 
     analysis_initial(); // output initial lattice analysis
@@ -213,16 +306,39 @@ int main(int argc, char *argv[])
 
     beta=1/((float)T/300.0);
 
+    // Density of states run replaces the fixed temperature simulation
+    if (WangLandau)
+    {
+        wang_landau(log);
+        if (SaveTrajectory) trajectory_close();
+        if (VideoStream) video_close();
+        if (DisplayDumbTerminal) terminal_close();
+        fprintf(stderr,"Monte Carlo moves - ACCEPT: %lu REJECT: %lu ratio: %f\n",ACCEPT,REJECT,(float)ACCEPT/(float)(REJECT+ACCEPT));
+        return 0;
+    }
+
     // Equilibriated before Hysterisis scan
+    sprintf(name,"Schedule_T_%04d.dat",T);
+    schedule_init(name);
+
     fprintf(stderr,"Equilibriation MC moves... %e\n",(double)MCMinorSteps*(double)MCEqmSteps);
-    for (i=0;i<MCEqmSteps;i++)
+    autocorrelation_reset();
+    for (i=0; i<(AutoEquilibrate ? MaxMCEqmSteps : MCEqmSteps); i++)
     {
         fprintf(stderr,",");
         MC_moves(MCMinorSteps);
+        if (AutoEquilibrate && i+1>=MCEqmSteps && equilibrated(log)) break;
     }
 
     if(CalculateEfield) lattice_Efield_XYZ("equilib_lattice_efield.xyz");
     if(SaveDipolesSVG)   outputlattice_svg("equilib-SVG.svg");
+
+    if(SaveSamples)
+    {
+        sprintf(name,"Samples_T_%04d.dat",T);
+        samples=fopen(name,"w");
+        fprintf(samples,"# Samples T: %d N: %d CageStrain: %f\n# moves E P Landau\n",T,X*Y*Z,CageStrain);
+    }
     if(CalculatePotential) outputpotential_png("equilib_pot.png"); //"final_pot.png");
 
     // FIXME: This commented code applies a time-varying field. Either delete
@@ -238,16 +354,29 @@ int main(int argc, char *argv[])
         beta=1/((float)T/300.0); 
         // recalculate thermodynamic Beta (used internally), in case T has changed (for loop)
 
+        moments_reset(); // only average over the production run
+        autocorrelation_reset();
+
         // Do some MC moves!
         // THIS IS THE SIMULATION CORE / HOT LOOP.
-        for (i=0;i<MCMegaSteps;i++)
+        for (i=0; i<(AutoEquilibrate ? MaxMCMegaSteps : MCMegaSteps); i++)
         {
             //            initialise_lattice(); // RESET LATTICE!
             tic=clock(); // measured in CLOCKS_PER_SECs of a second
-            MC_moves(MCMinorSteps);
+            if (SaveSamples)
+                for (j=0;j<SamplesPerMegaStep;j++)
+                {
+                    // the last chunk takes the remainder; still MCMinorSteps in all
+                    MC_moves(MCMinorSteps/SamplesPerMegaStep
+                            + (j==SamplesPerMegaStep-1 ? MCMinorSteps%SamplesPerMegaStep : 0));
+                    sample_log(samples);
+                }
+            else
+                MC_moves(MCMinorSteps);
             toc=clock();
 
             analysis_midpoint(i,log);
+            if (AutoEquilibrate && i+1>=MCMegaSteps && converged(log)) break;
             fflush(stdout); // flush the output buffer, so we can live-graph / it's saved if we interupt
 
             tac=clock();
@@ -267,7 +396,16 @@ int main(int argc, char *argv[])
 
     fprintf(stderr,"\n");
 
+    analysis_drain(); // wait for any asynchronous analysis
     analysis_final();
+    if (SaveSamples) fclose(samples);
+    if (TrackWalls) fclose(wallslog);
+    if (SaveTrajectory) trajectory_close();
+    if (VideoStream) video_close();
+    if (DisplayDumbTerminal) terminal_close();
+    fclose(schedulelog);
+    if (LogMoments) // e.g. make parallel-annamaria; to stderr if stdout is the video
+        moments_log(VideoStream && strcmp(VideoOutput,"-")==0 ? stderr : stdout);
 
     fprintf(stderr,"Monte Carlo moves - ACCEPT: %lu REJECT: %lu ratio: %f\n",ACCEPT,REJECT,(float)ACCEPT/(float)(REJECT+ACCEPT));
     fprintf(stderr," For us, there is only the trying. The rest is not our business. ~T.S.Eliot\n\n");
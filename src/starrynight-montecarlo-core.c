@@ -11,7 +11,12 @@
 static int rand_int(int SPAN);
 static void gen_neighbour();
 static double site_energy(int x, int y, int z, struct dipole *newdipole, struct dipole *olddipole);
+static double lattice_energy(struct energy *terms);
+static void energy_check(FILE *log);
+static void lattice_dipole_sum();
 static void MC_moves(int moves);
+static int MC_trial(int *x, int *y, int *z, struct dipole *newdipole);
+static void MC_accept(int x, int y, int z, struct dipole *newdipole, double dE);
 static void MC_move();
 static void MC_move_openmp();
 
@@ -35,49 +40,41 @@ struct {
 } neighbours[MAXNEIGHBOURS];
 int neighbour=0; //count of neighbours
 
+int sweepcountdown=0; // MC moves until the next once-per-sweep sample
+
 static void gen_neighbour()
 {
+    struct sphere *s=sphere_stencil(DipoleCutOff,STENCIL_SITE);
+    int j;
 
-    int dx,dy,dz=0;
-    float d;
-
-    int ZCutOff=DipoleCutOff;
-    if (Z==1) ZCutOff=0;
-
-    for (dx=-DipoleCutOff;dx<=DipoleCutOff;dx++)
-        for (dy=-DipoleCutOff;dy<=DipoleCutOff;dy++)
-            for (dz=-ZCutOff;dz<=ZCutOff;dz++) //NB: conditional zDipoleCutOff to allow for 2D version
-            {
-                if (dx==0 && dy==0 && dz==0)
-                    continue; //no infinities / self interactions please!
-
-                d=sqrt((float) dx*dx + dy*dy + dz*dz); //that old chestnut; distance in Euler space
-
-                if (d>(float)DipoleCutOff) continue; // Cutoff in d
+    for (j=1;j<s->n;j++) // from 1: no infinities / self interactions please!
+    {
+        if (Z==1 && s->dz[j]!=0) continue; //NB: in plane only, to allow for 2D version
 
-                // store precomputed list of neighbours
-                neighbours[neighbour].dx=dx; neighbours[neighbour].dy=dy; neighbours[neighbour].dz=dz;
-                neighbours[neighbour].d=d;
-                neighbour++;
+        // store precomputed list of neighbours
+        neighbours[neighbour].dx=s->dx[j]; neighbours[neighbour].dy=s->dy[j]; neighbours[neighbour].dz=s->dz[j];
+        neighbours[neighbour].d=s->d[j];
+        neighbour++;
 
-                fprintf(stderr,"Neighbour: %d %d %d\n",dx,dy,dz);
+        fprintf(stderr,"Neighbour: %d %d %d\n",s->dx[j],s->dy[j],s->dz[j]);
 
-                if (neighbour>MAXNEIGHBOURS) // bounds check
-                {
-                    fprintf(stderr,"Run out of space for the neighbour list with %d neighbours. FAILING TO EXIT!\n\n", neighbour);
-                    exit(-1);
-                }
-            }
+        if (neighbour>MAXNEIGHBOURS) // bounds check
+        {
+            fprintf(stderr,"Run out of space for the neighbour list with %d neighbours. FAILING TO EXIT!\n\n", neighbour);
+            exit(-1);
+        }
+    }
     fprintf(stderr,"\nNeighbour list generated: %d neighbours found with DipoleCutOff=%d.\n",neighbour,DipoleCutOff);
 }
 
 
 // Calculate change in site energy of changing from olddipole -> newdipole
+// The split into terms of the Hamiltonian is left in dEterms, for MC_accept()
 static double site_energy(int x, int y, int z, struct dipole *newdipole, struct dipole *olddipole)
 {
     int dx,dy,dz=0;
     float d;
-    double dE=0.0;
+    double dE=0.0, dEstrain=0.0;
     struct dipole *testdipole, n;
 
     // This now iterates over the neighbour list of neighbours[0..neighbour]
@@ -111,28 +108,33 @@ static double site_energy(int x, int y, int z, struct dipole *newdipole, struct
 
         // Now reborn as our cage-strain term!
         if ((dx*dx+dy*dy+dz*dz)==1) //only nearest neighbour
-            dE+= - CageStrain* dot(newdipole,testdipole)
+            dEstrain+= - CageStrain* dot(newdipole,testdipole)
                 + CageStrain * dot(olddipole,testdipole); // signs to energetic drive alignment of vectors (dot product = more +ve, dE = -ve)
 
     }
+    dEterms.dipole=dE;
+    dEterms.strain=dEstrain;
 
     // Interaction of dipole with (unshielded) E-field
-    dE+= + dot(newdipole, & Efield)
+    dEterms.field= + dot(newdipole, & Efield)
         - dot(olddipole, & Efield);
     //fprintf(stderr,"%f\n",dot(newdipole, & Efield));
 
+    dEterms.K=0.0;
     if (K>0.0) // rarely used anymore; 2D lattice epitaxial strain term
     {
         // along .x projection, squared
         n.x=1.0; n.y=0.0; n.z=0.0;
-        dE +=   - K*fabs(dot(newdipole,&n))
+        dEterms.K +=   - K*fabs(dot(newdipole,&n))
             + K*fabs(dot(olddipole,&n));
         // along .y projection, squared
         n.x=0.0; n.y=1.0; n.z=0.0;
-        dE +=   - K*fabs(dot(newdipole,&n))
+        dEterms.K +=   - K*fabs(dot(newdipole,&n))
             + K*fabs(dot(olddipole,&n));
     }
 
+    dE=dEterms.dipole+dEterms.strain+dEterms.field+dEterms.K;
+
     // point charge at centre of space
     //    n.x=x-(X/2); n.y=y-(Y/2); n.z=z-(Z/2);
     //    dE += 1.0 * (dot(newdipole,&n) - dot(olddipole,&n) ) / ((x-X/2)^2 - (y-Y/2)^2 - (z-Z/2)^2);
@@ -140,53 +142,184 @@ static double site_energy(int x, int y, int z, struct dipole *newdipole, struct
     return(dE); 
 }
 
+// Full evaluation of the lattice energy, split into terms of the Hamiltonian;
+// O(N*neighbours) so only for seeding / checking the running totals. Mirrors
+// site_energy() term by term, with pair terms (dipole-dipole, cage strain)
+// counted once per pair, so that summing the dE of accepted moves tracks this
+// value exactly.
+static double lattice_energy(struct energy *terms)
+{
+    int x,y,z;
+    int i,dx,dy,dz;
+    float d;
+    double Edipole=0.0, Estrain=0.0, Efieldterm=0.0, EK=0.0;
+    struct dipole *p, *testdipole, n;
+
+#pragma omp parallel for private(y,z,i,dx,dy,dz,d,p,testdipole,n) reduction(+:Edipole,Estrain,Efieldterm,EK)
+    for (x=0;x<X;x++)
+        for (y=0;y<Y;y++)
+            for (z=0;z<Z;z++)
+            {
+                p=& lattice[x][y][z];
+
+                for (i=0;i<neighbour;i++)
+                {
+                    dx=neighbours[i].dx; dy=neighbours[i].dy; dz=neighbours[i].dz;
+                    d=neighbours[i].d;
+
+                    testdipole=& lattice[(X+x+dx)%X][(Y+y+dy)%Y][(Z+z+dz)%Z];
+
+                    n.x=(float)dx/d; n.y=(float)dy/d; n.z=(float)dz/d; //normalised diff. vector
+
+                    Edipole+= 0.5 * (p->length * testdipole->length) *
+                        ( dot(p,testdipole) - 3*dot(&n,p)*dot(&n,testdipole) ) / (d*d*d);
+
+                    if ((dx*dx+dy*dy+dz*dz)==1) //only nearest neighbour
+                        Estrain+= - 0.5 * CageStrain * dot(p,testdipole);
+                }
+
+                Efieldterm+= dot(p, & Efield);
+
+                if (K>0.0)
+                    EK+= - K*fabs(p->x) - K*fabs(p->y);
+            }
+
+    terms->dipole=Edipole;
+    terms->strain=Estrain;
+    terms->field=Efieldterm;
+    terms->K=EK;
+    return(Edipole+Estrain+Efieldterm+EK);
+}
+
+// Seed the running total dipole, Ptotal
+static void lattice_dipole_sum()
+{
+    int x,y,z;
+
+    Ptotal.x=0.0; Ptotal.y=0.0; Ptotal.z=0.0;
+    for (x=0;x<X;x++)
+        for (y=0;y<Y;y++)
+            for (z=0;z<Z;z++)
+            {
+                Ptotal.x+=lattice[x][y][z].x;
+                Ptotal.y+=lattice[x][y][z].y;
+                Ptotal.z+=lattice[x][y][z].z;
+            }
+}
+
+// Brute force check of the running energy against lattice_energy(); reports
+// the accumulated drift and then resets the running totals (and Ptotal) to
+// the exact ones.
+static void energy_check(FILE *log)
+{
+    struct energy full;
+    double E,Px=Ptotal.x;
+
+    E=lattice_energy(&full);
+    lattice_dipole_sum();
+
+    fprintf(stderr,"Energy check: running %f full %f drift %e (dipole %e strain %e field %e K %e) Px drift %e\n",
+            Etotal,E,Etotal-E,
+            Eterms.dipole-full.dipole,Eterms.strain-full.strain,Eterms.field-full.field,Eterms.K-full.K,
+            Px-Ptotal.x);
+    fprintf(log,"# Energy check: moves %lu running %f full %f drift %e\n",ACCEPT+REJECT,Etotal,E,Etotal-E);
+
+    Etotal=E;
+    Eterms=full;
+
+    if (IncrementalPotential) potential_check(log);
+    if (TrackWalls) walls_check(log);
+    if (QuantiseDipoles) quantise_log(log);
+}
+
 static void MC_moves(int moves)
 {
     int i;
     //moves/=8; //hard coded domain decomp.
     for (i=0;i<moves;i++)
+    {
         MC_move();
+
+        if (--sweepcountdown<=0) // once per sweep; from running totals so O(1)
+        {
+            sweepcountdown=X*Y*Z;
+            moments_sample();
+            if (AutoEquilibrate) autocorrelation_sample();
+            if (TrackWalls) walls_sample();
+            if (SaveTrajectory) trajectory_sample();
+            if (VideoStream) video_sample();
+        }
+    }
 }
 
-static void MC_move()
+// Choose a random site + random new orientation for it. Returns false if the
+// site is empty (no dipole), in which case there is nothing to move.
+static int MC_trial(int *x, int *y, int *z, struct dipole *newdipole)
 {
-    int x, y, z;
-    float dE=0.0;
-    struct dipole newdipole, *olddipole;
-
     // Choose random dipole / lattice location
 
-    x=rand_int(X);
-    y=rand_int(Y);
-    z=rand_int(Z);
+    *x=rand_int(X);
+    *y=rand_int(Y);
+    *z=rand_int(Z);
 
-    if (lattice[x][y][z].length==0.0) return; //dipole zero length .'. not present
+    if (lattice[*x][*y][*z].length==0.0) return false; //dipole zero length .'. not present
 
-    // random new orientation. 
+    // random new orientation.
     // Nb: this is the definition of a MC move - might want to consider
     // alternative / global / less disruptive moves as well
     if (ConstrainToX)
-        random_X_point(& newdipole); //consider any <100> vector
+        random_X_point(newdipole); //consider any <100> vector
     else
-        random_sphere_point(& newdipole);    
+        random_sphere_point(newdipole);
+    if (QuantiseDipoles) octahedral_snap(newdipole); // <100> are on the grid already
+
+    newdipole->length = lattice[*x][*y][*z].length; // preserve length / i.d. of dipole
+
+    return true;
+}
+
+// Commit an accepted move. Anything tracking the lattice incrementally is
+// updated here, so alternative samplers (Wang-Landau etc.) stay in step.
+static void MC_accept(int x, int y, int z, struct dipole *newdipole, double dE)
+{
+    if (IncrementalPotential) potential_accept(x,y,z,newdipole);
+    if (TrackWalls) walls_accept(x,y,z,newdipole);
+    if (CalculateOrientations) orientations_accept(x,y,z,newdipole);
+    if (SaveTrajectory) trajectory_accept(x,y,z);
+
+    Ptotal.x+=newdipole->x-lattice[x][y][z].x;
+    Ptotal.y+=newdipole->y-lattice[x][y][z].y;
+    Ptotal.z+=newdipole->z-lattice[x][y][z].z;
+
+    lattice[x][y][z].x=newdipole->x;
+    lattice[x][y][z].y=newdipole->y;
+    lattice[x][y][z].z=newdipole->z;
+    //      lattice[x][y][z].length=newdipole.length; // never changes with current
+    //      algorithms.
+
+    Etotal+=dE;
+    Eterms.dipole+=dEterms.dipole;
+    Eterms.strain+=dEterms.strain;
+    Eterms.field+=dEterms.field;
+    Eterms.K+=dEterms.K;
+
+    lattice_version++;
+    ACCEPT++;
+}
+
+static void MC_move()
+{
+    int x, y, z;
+    double dE=0.0;
+    struct dipole newdipole;
 
-    newdipole.length = lattice[x][y][z].length; // preserve length / i.d. of dipole
-    olddipole=& lattice[x][y][z];
+    if (!MC_trial(&x,&y,&z, & newdipole)) return;
 
     //calc site energy
-    dE=site_energy(x,y,z, & newdipole,olddipole);
+    dE=site_energy(x,y,z, & newdipole, & lattice[x][y][z]);
 
     if (dE < 0.0 || exp(-dE * beta) > genrand_real2() )
-    {
-        lattice[x][y][z].x=newdipole.x;
-        lattice[x][y][z].y=newdipole.y;
-        lattice[x][y][z].z=newdipole.z;
-        //      lattice[x][y][z].length=newdipole.length; // never changes with current
-        //      algorithms.
-
-        ACCEPT++;
-    }
+        MC_accept(x,y,z, & newdipole, dE);
     else
         REJECT++;
 }
-
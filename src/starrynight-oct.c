@@ -0,0 +1,127 @@
+/* Starry Night - a Monte Carlo code to simulate ferroelectric domain formation
+ * and behaviour in hybrid perovskite solar cells.
+ *
+ * By Jarvist Moore Frost
+ * University of Bath
+ *
+ * File begun 16th January 2014
+ */
+
+// starrynight-oct - reads the *_dipoles.oct snapshots written with
+// SaveDipolesOctahedral: true (format in starrynight-octahedral.c), and prints
+// the lattice: x y z px py pz length, one site a line, as starrynight-traj.
+// The orientations decode to exactly the floats the simulation held.
+//
+// Usage: ./starrynight-oct T_0300_i_009_dipoles.oct > lattice.dat
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+
+enum {OCTAHEDRAL_EMPTY=0x80}; // species bit: no orientation
+
+struct
+{
+    int32_t X,Y,Z,bits,species;
+    float length[OCTAHEDRAL_EMPTY];
+} header;
+
+static void die(char * message)
+{
+    fprintf(stderr,"starrynight-oct: %s\n",message);
+    exit(EXIT_FAILURE);
+}
+
+static void read_or_die(void *p, size_t size, size_t n, FILE *fi)
+{
+    if (fread(p,size,n,fi)!=n) die("unexpected end of file");
+}
+
+static void read_header(FILE *fi)
+{
+    char magic[8];
+    int32_t i32[5];
+
+    read_or_die(magic,1,8,fi);
+    if (memcmp(magic,"SNOCT02",8)!=0) die("not a StarryNight octahedral snapshot");
+    read_or_die(i32,sizeof(int32_t),5,fi);
+    header.X=i32[0]; header.Y=i32[1]; header.Z=i32[2]; header.bits=i32[3]; header.species=i32[4];
+    if (header.X<1 || header.Y<1 || header.Z<1) die("bad lattice size");
+    if (header.bits!=8 && header.bits!=16) die("bad encoding");
+    if (header.species<1 || header.species>=OCTAHEDRAL_EMPTY) die("bad species table");
+    read_or_die(header.length,sizeof(float),header.species,fi);
+}
+
+static float sign_nonzero(float a)
+{
+    return(a<0.0 ? -1.0 : 1.0);
+}
+
+// As octahedral_decode() in the simulation, operation for operation
+static void decode(uint32_t code, float *p)
+{
+    int levels=(1<<header.bits)-2;
+    float u=(code>>16)*2.0/levels-1.0, v=(code&0xFFFF)*2.0/levels-1.0, t, norm;
+
+    p[0]=u; p[1]=v; p[2]=1.0-fabs(u)-fabs(v);
+    if (p[2]<0.0)
+    {
+        t=p[0];
+        p[0]=(1.0-fabs(p[1]))*sign_nonzero(t);
+        p[1]=(1.0-fabs(t))*sign_nonzero(p[1]);
+    }
+    norm=sqrt(p[0]*p[0]+p[1]*p[1]+p[2]*p[2]);
+    p[0]/=norm; p[1]/=norm; p[2]/=norm;
+}
+
+int main(int argc, char *argv[])
+{
+    FILE *fi;
+    int i,x,y,z;
+    uint8_t s,uv8[2];
+    uint16_t uv16[2];
+    uint32_t code;
+    float p[3];
+
+    if (argc<2)
+    {
+        fprintf(stderr,"Usage: %s T_xxxx_i_xxx_dipoles.oct\n",argv[0]);
+        return(EXIT_FAILURE);
+    }
+    fi=fopen(argv[1],"rb");
+    if (fi==NULL) die("can't open snapshot");
+
+    read_header(fi);
+    printf("# X: %d Y: %d Z: %d OctahedralBits: %d\n",header.X,header.Y,header.Z,header.bits);
+    for (i=0;i<header.species;i++)
+        printf("# species %d length: %f\n",i,header.length[i]);
+    printf("# x y z px py pz length\n");
+
+    for (x=0;x<header.X;x++)
+        for (y=0;y<header.Y;y++)
+            for (z=0;z<header.Z;z++)
+            {
+                read_or_die(&s,1,1,fi);
+                if (header.bits>8)
+                {
+                    read_or_die(uv16,sizeof(uint16_t),2,fi);
+                    code=(uint32_t)uv16[0]<<16 | uv16[1];
+                }
+                else
+                {
+                    read_or_die(uv8,sizeof(uint8_t),2,fi);
+                    code=(uint32_t)uv8[0]<<16 | uv8[1];
+                }
+                if ((s & ~OCTAHEDRAL_EMPTY)>=header.species) die("bad species");
+                if (s & OCTAHEDRAL_EMPTY)
+                    p[0]=p[1]=p[2]=0.0;
+                else
+                    decode(code,p);
+                printf("%d %d %d %f %f %f %f\n",x,y,z,p[0],p[1],p[2],header.length[s & ~OCTAHEDRAL_EMPTY]);
+            }
+
+    fclose(fi);
+    return(0);
+}
@@ -0,0 +1,181 @@
+/* Starry Night - a Monte Carlo code to simulate ferroelectric domain formation
+ * and behaviour in hybrid perovskite solar cells.
+ *
+ * By Jarvist Moore Frost
+ * University of Bath
+ *
+ * File begun 16th January 2014
+ */
+
+// Quantised snapshots. Octahedral encoding of unit vectors in 2 x
+// OctahedralBits (8 or 16) bits: project onto the octahedron |x|+|y|+|z|=1,
+// fold the lower half over the upper, and quantise the resulting square. Each
+// axis has 2^bits-1 levels, so that 0 and the <100> directions are exact.
+//
+// QuantiseDipoles snaps every orientation (initial lattice and MC trials) to
+// this grid, so the lattice is always exactly representable in the compact
+// form: snapshots are then lossless at 2 or 4 bytes, plus a species byte, per
+// site, c.f. 16 for struct dipole. As the trials are uniform on the sphere,
+// each grid point is proposed in proportion to its solid angle; i.e. this is
+// the continuous model integrated by quadrature over the grid. The cost of
+// snapping is reported: the largest angle any orientation was moved, and the
+// change in energy from snapping the initial lattice.
+//
+// This saves no memory: only the snapshots are compact, the lattice in memory
+// is still struct dipole, read directly by every analysis. (A packed copy for the MC core
+// alone, decoded per neighbour in site_energy(), measured 1.4-2x slower per
+// trial, and as an extra copy would save no memory.) The decoding is repeated
+// in starrynight-oct, operation for operation.
+
+enum {OCTAHEDRAL_EMPTY=0x80}; // species byte: no orientation
+
+// Prototypes...
+static uint32_t octahedral_encode(struct dipole *p);
+static void octahedral_decode(uint32_t code, struct dipole *p);
+static void octahedral_snap(struct dipole *p);
+static uint8_t octahedral_species(struct dipole *p);
+static void lattice_quantise();
+static void quantise_log(FILE *log);
+static void lattice_octahedral(char * filename);
+
+double quantise_maxsin=0.0; // sin of the largest angle any orientation was moved
+static double lattice_energy(struct energy *terms); // in montecarlo-core
+
+static float sign_nonzero(float a)
+{
+    return(a<0.0 ? -1.0 : 1.0);
+}
+
+// (u,v) packed as u<<16 | v
+static uint32_t octahedral_encode(struct dipole *p)
+{
+    float norm=fabs(p->x)+fabs(p->y)+fabs(p->z);
+    float u=p->x/norm, v=p->y/norm, t;
+    int levels=(1<<OctahedralBits)-2; // top code; so 0.0 is levels/2 exactly
+
+    if (p->z<0.0) // fold the lower half over
+    {
+        t=u;
+        u=(1.0-fabs(v))*sign_nonzero(t);
+        v=(1.0-fabs(t))*sign_nonzero(v);
+    }
+    return(((uint32_t)lrintf((u+1.0)*0.5*levels)<<16) | (uint32_t)lrintf((v+1.0)*0.5*levels));
+}
+
+static void octahedral_decode(uint32_t code, struct dipole *p)
+{
+    int levels=(1<<OctahedralBits)-2;
+    float u=(code>>16)*2.0/levels-1.0, v=(code&0xFFFF)*2.0/levels-1.0, t, norm;
+
+    p->x=u; p->y=v; p->z=1.0-fabs(u)-fabs(v);
+    if (p->z<0.0)
+    {
+        t=p->x;
+        p->x=(1.0-fabs(p->y))*sign_nonzero(t);
+        p->y=(1.0-fabs(t))*sign_nonzero(p->y);
+    }
+    norm=sqrt(p->x*p->x+p->y*p->y+p->z*p->z);
+    p->x/=norm; p->y/=norm; p->z/=norm;
+}
+
+// Round trip p through the encoding; a zero orientation (vacancy) is left be
+static void octahedral_snap(struct dipole *p)
+{
+    struct dipole q;
+    double cx,cy,cz,s; // |p x q|; for small angles, unlike acos(p.q), not lost to float
+
+    if (p->x==0.0 && p->y==0.0 && p->z==0.0) return;
+    octahedral_decode(octahedral_encode(p),&q);
+
+    cx=(double)p->y*q.z-(double)p->z*q.y;
+    cy=(double)p->z*q.x-(double)p->x*q.z;
+    cz=(double)p->x*q.y-(double)p->y*q.x;
+    s=sqrt((cx*cx+cy*cy+cz*cz)/((double)p->x*p->x+(double)p->y*p->y+(double)p->z*p->z));
+    if (s>quantise_maxsin) quantise_maxsin=s;
+    p->x=q.x; p->y=q.y; p->z=q.z;
+}
+
+// Species byte of a site: its length, as an index into dipoles[] (every
+// length is one of them); | OCTAHEDRAL_EMPTY if it has no orientation, so
+// that both survive the round trip, separately
+static uint8_t octahedral_species(struct dipole *p)
+{
+    uint8_t s=0;
+    int j;
+
+    for (j=0;j<dipolecount;j++)
+        if (dipoles[j].length==p->length) { s=j; break; }
+    if (p->x==0.0 && p->y==0.0 && p->z==0.0) s|=OCTAHEDRAL_EMPTY;
+    return(s);
+}
+
+// Snap the whole lattice, reporting the energy it cost
+static void lattice_quantise()
+{
+    int x,y,z;
+    struct energy terms;
+    double E=lattice_energy(&terms),dE;
+
+    for (x=0;x<X;x++)
+        for (y=0;y<Y;y++)
+            for (z=0;z<Z;z++)
+                octahedral_snap(& lattice[x][y][z]);
+    lattice_version++;
+
+    dE=lattice_energy(&terms)-E;
+    fprintf(stderr,"Quantised dipoles to %d bit octahedral: energy change %e (%e per site), max angle %f deg\n",
+            OctahedralBits,dE,dE/(X*Y*Z),asin(quantise_maxsin)*180.0/M_PI);
+}
+
+static void quantise_log(FILE *log)
+{
+    fprintf(log,"# Quantisation: %d bit octahedral, max angle error %f deg\n",OctahedralBits,asin(quantise_maxsin)*180.0/M_PI);
+}
+
+// Compact snapshot: "SNOCT02\0", int32 X Y Z bits species, species x float
+// length, then per site (x*Y+y)*Z+z a uint8 species (octahedral_species())
+// and the code as 2 x uint8 (8 bit) or 2 x uint16 (16 bit), u then v. Native
+// endian. Read with starrynight-oct.
+static void lattice_octahedral(char * filename)
+{
+    int32_t i32[5];
+    int j,x,y,z;
+    uint8_t s;
+    uint32_t code;
+    uint16_t uv16[2];
+    uint8_t uv8[2];
+    float length;
+    struct dipole *p;
+    FILE *fo;
+
+    fo=fopen(filename,"wb");
+    fwrite("SNOCT02",1,8,fo);
+    i32[0]=X; i32[1]=Y; i32[2]=Z; i32[3]=OctahedralBits; i32[4]=dipolecount;
+    fwrite(i32,sizeof(int32_t),5,fo);
+    for (j=0;j<dipolecount;j++)
+    {
+        length=dipoles[j].length;
+        fwrite(&length,sizeof(float),1,fo);
+    }
+
+    for (x=0;x<X;x++)
+        for (y=0;y<Y;y++)
+            for (z=0;z<Z;z++)
+            {
+                p=& lattice[x][y][z];
+                s=octahedral_species(p);
+                code= s & OCTAHEDRAL_EMPTY ? 0 : octahedral_encode(p);
+                fwrite(&s,1,1,fo);
+                if (OctahedralBits>8)
+                {
+                    uv16[0]=code>>16; uv16[1]=code&0xFFFF;
+                    fwrite(uv16,sizeof(uint16_t),2,fo);
+                }
+                else
+                {
+                    uv8[0]=code>>16; uv8[1]=code&0xFFFF;
+                    fwrite(uv8,sizeof(uint8_t),2,fo);
+                }
+            }
+    fclose(fo);
+}
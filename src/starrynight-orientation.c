@@ -0,0 +1,115 @@
+/* Starry Night - a Monte Carlo code to simulate ferroelectric domain formation
+ * and behaviour in hybrid perovskite solar cells.
+ *
+ * By Jarvist Moore Frost
+ * University of Bath
+ *
+ * File begun 16th January 2014
+ */
+
+// Orientation distribution of the dipoles, per species (entry of Dipoles in
+// the config), on an equal area grid over the sphere: OrientationBands bands
+// evenly spaced in z=cos(theta) (Archimedes: equal z slices have equal area)
+// by 2*OrientationBands sectors in phi.
+//
+// Seeded once by lattice_orientations(), then every accepted move shifts one
+// count from the old bin to the new in orientations_accept(); so O(1) per
+// move, and O(bins) per snapshot.
+
+// Prototypes...
+static int orientation_bin(struct dipole *p);
+static int orientation_species(struct dipole *p);
+static void lattice_orientations();
+static void orientations_accept(int x, int y, int z, struct dipole *newdipole);
+static void orientations_log(char * filename);
+
+int *orientation_count=NULL; // [species][bin], flattened
+int orientation_bins=0;
+
+static int orientation_bin(struct dipole *p)
+{
+    int sectors=2*OrientationBands;
+    int band=(int)((p->z+1.0)/2.0*OrientationBands);
+    int sector=(int)((atan2(p->y,p->x)+M_PI)/(2.0*M_PI)*sectors);
+
+    if (band<0) band=0;
+    if (band>=OrientationBands) band=OrientationBands-1;
+    if (sector>=sectors) sector=sectors-1; // phi=pi
+    return(band*sectors+sector);
+}
+
+// Index into dipoles[] by length; -1 for an empty site
+static int orientation_species(struct dipole *p)
+{
+    int i;
+
+    if (p->length==0.0) return(-1);
+    for (i=0;i<dipolecount;i++)
+        if (dipoles[i].length==p->length) return(i);
+    return(-1);
+}
+
+// Full count; seeds the histogram
+static void lattice_orientations()
+{
+    int x,y,z,s;
+
+    orientation_bins=2*OrientationBands*OrientationBands;
+    if (orientation_count==NULL)
+        orientation_count=(int *)malloc(sizeof(int)*dipolecount*orientation_bins);
+    memset(orientation_count,0,sizeof(int)*dipolecount*orientation_bins);
+
+    for (x=0;x<X;x++)
+        for (y=0;y<Y;y++)
+            for (z=0;z<Z;z++)
+            {
+                s=orientation_species(&lattice[x][y][z]);
+                if (s<0) continue;
+                orientation_count[s*orientation_bins+orientation_bin(&lattice[x][y][z])]++;
+            }
+}
+
+// Called from MC_accept() before the lattice is updated
+static void orientations_accept(int x, int y, int z, struct dipole *newdipole)
+{
+    int s=orientation_species(&lattice[x][y][z]);
+
+    if (s<0) return;
+    orientation_count[s*orientation_bins+orientation_bin(&lattice[x][y][z])]--;
+    orientation_count[s*orientation_bins+orientation_bin(newdipole)]++;
+}
+
+// Appends one block per call: bin centre (z, phi) then, per species, the
+// count and the density (fraction of that species per steradian)
+static void orientations_log(char * filename)
+{
+    int b,s,total[10];
+    int sectors=2*OrientationBands;
+    double area=4.0*M_PI/orientation_bins;
+    FILE *fo;
+
+    for (s=0;s<dipolecount;s++)
+    {
+        total[s]=0;
+        for (b=0;b<orientation_bins;b++) total[s]+=orientation_count[s*orientation_bins+b];
+    }
+
+    fo=fopen(filename,"a"); // Open in append mode. If filename doesn't exist, it is created.
+    fprintf(fo,"# moves: %lu bands: %d sectors: %d species:",ACCEPT+REJECT,OrientationBands,sectors);
+    for (s=0;s<dipolecount;s++)
+        if (dipoles[s].length!=0.0) fprintf(fo," %f (%d)",dipoles[s].length,total[s]);
+    fprintf(fo,"\n# z phi [count density] per species\n");
+
+    for (b=0;b<orientation_bins;b++)
+    {
+        fprintf(fo,"%f %f",-1.0+(b/sectors+0.5)*2.0/OrientationBands,
+                -M_PI+(b%sectors+0.5)*2.0*M_PI/sectors);
+        for (s=0;s<dipolecount;s++)
+            if (dipoles[s].length!=0.0) // empty sites aren't a species
+                fprintf(fo," %d %f",orientation_count[s*orientation_bins+b],
+                        total[s]>0 ? orientation_count[s*orientation_bins+b]/(area*total[s]) : 0.0);
+        fprintf(fo,"\n");
+    }
+    fprintf(fo,"\n\n");
+    fclose(fo);
+}
@@ -0,0 +1,149 @@
+/* Starry Night - a Monte Carlo code to simulate ferroelectric domain formation
+ * and behaviour in hybrid perovskite solar cells.
+ *
+ * By Jarvist Moore Frost
+ * University of Bath
+ *
+ * File begun 16th January 2014
+ */
+
+// Asynchronous analysis. With AsyncAnalysis, the output routines of each
+// megastep run in a fork()ed child: a copy-on-write snapshot of the whole
+// simulation (lattice, running totals, caches), so the analysis code reads
+// its globals as ever while the parent carries on with MC moves.
+//  - Backpressure: at most AnalysisQueue snapshots in flight; the parent
+//    waits on the oldest before forking another.
+//  - Ordering: each child blocks until its predecessor has exited (on a
+//    pipe whose only write end the predecessor holds), so appended files
+//    are written in megastep order.
+//  - Log: only the parent writes the log. A child's log lines go down a
+//    pipe, copied into the log when the parent reaps it; whole, in megastep
+//    order, and (as reaping is at fixed points) the same run to run, though
+//    up to AnalysisQueue megasteps after their own E: line.
+//  - Drain: analysis_drain() waits for every child, at the end of the run.
+// Analysis that changes the simulation state (drift checks, accumulators)
+// must stay in the parent; see analysis_midpoint().
+//
+// libgomp's thread pool does not survive fork(), so the children run their
+// OpenMP loops on one thread.
+
+#include <errno.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+// Prototypes...
+void analysis_outputs(int MCstep, FILE *log); // in main
+static void analysis_snapshot(int MCstep, FILE *log);
+static void analysis_wait_oldest();
+static void analysis_drain();
+
+enum {MAXANALYSISQUEUE=64};
+struct
+{
+    pid_t pid[MAXANALYSISQUEUE]; // in flight, oldest first
+    int text[MAXANALYSISQUEUE]; // read ends of their log lines
+    int n;
+    int done; // read end of the newest child's pipe; EOF once it has exited
+    FILE *log;
+} pipeline={.n=0,.done=-1,.log=NULL};
+
+// Copy the oldest child's log lines into the log, then reap it
+static void analysis_wait_oldest()
+{
+    int i;
+    char buffer[4096];
+    ssize_t got;
+
+    if (pipeline.n==0) return;
+    while ((got=read(pipeline.text[0],buffer,sizeof(buffer)))!=0) // to EOF: the child has finished
+    {
+        if (got<0 && errno==EINTR) continue;
+        if (got<0) break;
+        fwrite(buffer,1,got,pipeline.log);
+    }
+    close(pipeline.text[0]);
+    fflush(pipeline.log);
+    waitpid(pipeline.pid[0],NULL,0);
+    for (i=1;i<pipeline.n;i++)
+    {
+        pipeline.pid[i-1]=pipeline.pid[i];
+        pipeline.text[i-1]=pipeline.text[i];
+    }
+    pipeline.n--;
+}
+
+// Output routines for this megastep; now, or in a child process
+static void analysis_snapshot(int MCstep, FILE *log)
+{
+    int token[2],text[2],i;
+    char c;
+    pid_t pid;
+    FILE *lines;
+    int queue=AnalysisQueue<MAXANALYSISQUEUE ? AnalysisQueue : MAXANALYSISQUEUE;
+
+    if (!AsyncAnalysis || queue<1)
+    {
+        analysis_outputs(MCstep,log);
+        return;
+    }
+
+    while (pipeline.n>=queue) analysis_wait_oldest(); // backpressure
+
+    fflush(NULL); // else the child inherits (and rewrites) buffered output
+    if (pipe(token)!=0)
+        pid=-1;
+    else if (pipe(text)!=0)
+    {
+        close(token[0]); close(token[1]);
+        pid=-1;
+    }
+    else if ((pid=fork())<0)
+    {
+        close(token[0]); close(token[1]);
+        close(text[0]); close(text[1]);
+    }
+    if (pid<0)
+    {
+        fprintf(stderr,"Asynchronous analysis: pipe/fork failed; analysing in line.\n");
+        analysis_outputs(MCstep,log);
+        return;
+    }
+
+    if (pid==0) // child: holds token[1] until it exits
+    {
+        close(token[0]);
+        close(text[0]);
+        for (i=0;i<pipeline.n;i++) close(pipeline.text[i]); // the parent's to read
+        if (pipeline.done>=0)
+        {
+            while (read(pipeline.done,&c,1)>0); // predecessor still writing
+            close(pipeline.done);
+        }
+#ifdef _OPENMP
+        omp_set_num_threads(1);
+#endif
+        lines=fdopen(text[1],"w"); // the log, by way of the parent
+        analysis_outputs(MCstep,lines!=NULL ? lines : stderr);
+        fflush(NULL);
+        _exit(0);
+    }
+
+    close(token[1]);
+    close(text[1]);
+    if (pipeline.done>=0) close(pipeline.done);
+    pipeline.done=token[0];
+    pipeline.log=log;
+    pipeline.text[pipeline.n]=text[0];
+    pipeline.pid[pipeline.n++]=pid;
+}
+
+// Wait for all analysis in flight
+static void analysis_drain()
+{
+    while (pipeline.n>0) analysis_wait_oldest();
+    if (pipeline.done>=0) close(pipeline.done);
+    pipeline.done=-1;
+}
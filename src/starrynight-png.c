@@ -0,0 +1,152 @@
+/* Starry Night - a Monte Carlo code to simulate ferroelectric domain formation
+ * and behaviour in hybrid perovskite solar cells.
+ *
+ * By Jarvist Moore Frost
+ * University of Bath
+ *
+ * File begun 16th January 2014
+ */
+
+// PNG encoder (zlib deflate), so the .png outputs are PNGs, ready for movies
+// etc. without a conversion pass. Images are upscaled by whole pixels
+// (PNGScale; nearest neighbour, as 'convert -scale'), and each row is given
+// the PNG filter (of None, Sub, Up, Average, Paeth) that leaves it smallest,
+// rows in parallel (OpenMP). The repeated rows of an upscaled image filter
+// (Up) to zeros, so cost little.
+
+#include <zlib.h>
+
+// Prototypes...
+static void png_write(char * filename, unsigned char *pixels, int width, int height, int channels, int depth);
+
+static void png_chunk(FILE *fo, const char *type, unsigned char *data, uint32_t length)
+{
+    unsigned char b[4];
+    uLong crc;
+
+    b[0]=length>>24; b[1]=length>>16; b[2]=length>>8; b[3]=length;
+    fwrite(b,1,4,fo);
+    fwrite(type,1,4,fo);
+    if (length>0) fwrite(data,1,length,fo);
+
+    crc=crc32(0L,(const Bytef *)type,4);
+    if (length>0) crc=crc32(crc,data,length);
+    b[0]=crc>>24; b[1]=crc>>16; b[2]=crc>>8; b[3]=crc;
+    fwrite(b,1,4,fo);
+}
+
+static int png_paeth(int a, int b, int c)
+{
+    int p=a+b-c, pa=abs(p-a), pb=abs(p-b), pc=abs(p-c);
+
+    if (pa<=pb && pa<=pc) return(a);
+    if (pb<=pc) return(b);
+    return(c);
+}
+
+// Filter row (n bytes, bpp a pixel) against the row above (NULL for the
+// first) into out: a filter type byte, then n filtered bytes
+static void png_filter(unsigned char *out, unsigned char *row, unsigned char *up, int n, int bpp)
+{
+    unsigned char *trial=(unsigned char *)malloc(n);
+    long cost,best=LONG_MAX;
+    int f,i,a,b,c;
+
+    for (f=0;f<5;f++)
+    {
+        cost=0;
+        for (i=0;i<n;i++)
+        {
+            a= i>=bpp ? row[i-bpp] : 0; // left
+            b= up!=NULL ? up[i] : 0; // above
+            c= i>=bpp && up!=NULL ? up[i-bpp] : 0; // above left
+            switch (f)
+            {
+                case 0: trial[i]=row[i]; break;
+                case 1: trial[i]=row[i]-a; break;
+                case 2: trial[i]=row[i]-b; break;
+                case 3: trial[i]=row[i]-(a+b)/2; break;
+                case 4: trial[i]=row[i]-png_paeth(a,b,c); break;
+            }
+            cost+=abs((signed char)trial[i]); // the usual heuristic
+        }
+        if (cost<best)
+        {
+            best=cost;
+            out[0]=f;
+            memcpy(out+1,trial,n);
+        }
+    }
+    free(trial);
+}
+
+// pixels: height rows of width pixels, of channels (1 grey, 3 RGB) samples
+// of depth (8 or 16) bits; 16 bit samples as native unsigned shorts
+static void png_write(char * filename, unsigned char *pixels, int width, int height, int channels, int depth)
+{
+    int scale=PNGScale>1 ? PNGScale : 1;
+    int W=width*scale, H=height*scale;
+    int bpp=channels*depth/8; // bytes a pixel
+    int rowbytes=W*bpp;
+    unsigned char *image,*filtered,*compressed,*row,*src;
+    unsigned char ihdr[13];
+    uLongf size;
+    uint16_t sample;
+    int r,x,i,j;
+    FILE *fo;
+
+    // upscaled image, PNG sample order (16 bit big endian)
+    image=(unsigned char *)malloc((size_t)rowbytes*H);
+#pragma omp parallel for private(row,src,x,i,j,sample)
+    for (r=0;r<height;r++)
+    {
+        row=image+(size_t)r*scale*rowbytes;
+        for (x=0;x<width;x++)
+        {
+            src=pixels+((size_t)r*width+x)*bpp;
+            for (i=0;i<scale;i++)
+                for (j=0;j<channels;j++)
+                    if (depth==16)
+                    {
+                        sample=((uint16_t *)src)[j];
+                        row[(x*scale+i)*bpp+2*j]=sample>>8;
+                        row[(x*scale+i)*bpp+2*j+1]=sample&0xFF;
+                    }
+                    else
+                        row[(x*scale+i)*bpp+j]=src[j];
+        }
+        for (i=1;i<scale;i++)
+            memcpy(row+(size_t)i*rowbytes,row,rowbytes);
+    }
+
+    filtered=(unsigned char *)malloc((size_t)(rowbytes+1)*H);
+#pragma omp parallel for
+    for (r=0;r<H;r++)
+        png_filter(filtered+(size_t)r*(rowbytes+1),image+(size_t)r*rowbytes,
+                r>0 ? image+(size_t)(r-1)*rowbytes : NULL,rowbytes,bpp);
+    free(image);
+
+    size=compressBound((uLong)(rowbytes+1)*H);
+    compressed=(unsigned char *)malloc(size);
+    if (compress2(compressed,&size,filtered,(uLong)(rowbytes+1)*H,PNGCompression)!=Z_OK)
+    {
+        fprintf(stderr,"PNG: compression failed; %s not written\n",filename);
+        free(filtered); free(compressed);
+        return;
+    }
+    free(filtered);
+
+    fo=fopen(filename,"wb");
+    fwrite("\x89PNG\r\n\x1a\n",1,8,fo);
+    ihdr[0]=W>>24; ihdr[1]=W>>16; ihdr[2]=W>>8; ihdr[3]=W;
+    ihdr[4]=H>>24; ihdr[5]=H>>16; ihdr[6]=H>>8; ihdr[7]=H;
+    ihdr[8]=depth;
+    ihdr[9]=channels==3 ? 2 : 0; // colour type: RGB, or greyscale
+    ihdr[10]=0; ihdr[11]=0; ihdr[12]=0; // deflate, adaptive filtering, no interlace
+    png_chunk(fo,"IHDR",ihdr,13);
+    png_chunk(fo,"IDAT",compressed,size);
+    png_chunk(fo,"IEND",NULL,0);
+    fclose(fo);
+
+    free(compressed);
+}
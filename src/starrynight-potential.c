@@ -0,0 +1,251 @@
+/* Starry Night - a Monte Carlo code to simulate ferroelectric domain formation
+ * and behaviour in hybrid perovskite solar cells.
+ *
+ * By Jarvist Moore Frost
+ * University of Bath
+ *
+ * File begun 16th January 2014
+ */
+
+// Whole lattice electrostatic potential, as a convolution of the polarisation
+// field with the dipole kernel K(r) = r/|r|^3, done by FFT:
+//   phi(x) = sum_r p(x+r).K(r)   -->   phi^(k) = sum_a p^_a(k) conj(K^_a(k))
+// O(N log N) for every site at once, c.f. O(N*2000) for a direct sum per site.
+//
+// PotentialPeriodic: false reproduces the direct sum p.r/|r|^3 (cut off at 6
+// lattice units, with its periodic images); true is the full periodic
+// sum, by Ewald splitting the kernel (conducting 'tin foil' boundary, so no
+// k=0 term).
+//
+// IncrementalPotential: rather than recomputing, every accepted move scatters
+// its change in dipole over the (real space) kernel stencil, so phi is always
+// current and snapshots cost only I/O. Checked against a full recompute with
+// the energy drift check.
+
+// Prototypes...
+static void potential_kernel_init();
+static double * lattice_potential();
+static void potential_accept(int x, int y, int z, struct dipole *newdipole);
+static void potential_check(FILE *log);
+
+double complex *potential_kernel[3]={NULL,NULL,NULL}; // conj(K^_a), a=x,y,z
+double *potential=NULL; // phi at every site, flattened (x*Y+y)*Z+z
+unsigned long potential_version=ULONG_MAX; // lattice_version it was computed at
+
+// Real space kernel, for incremental updates; only non-zero entries
+struct stencil
+{
+    int dx,dy,dz;
+    double Kx,Ky,Kz;
+} *potential_stencil=NULL;
+int potential_stencil_n=0;
+
+// Add r/|r|^3 (times Ewald real space screening if alpha>0) at every lattice
+// vector r within cutoff, folded into the periodic cell
+static void potential_kernel_realspace(double complex *K[3], int CUTOFF, double alpha)
+{
+    struct sphere *s=sphere_stencil(CUTOFF,STENCIL_SITE);
+    int j,i;
+    double d,screen;
+
+    for (j=1;j<s->n;j++) // from 1: no infinities / self interactions please!
+    {
+        screen=1.0; // unscreened: exactly the direct sum
+        if (alpha>0.0)
+        {
+            d=sqrt((double)s->shell[j]);
+            screen=erfc(alpha*d) + 2.0*alpha*d/sqrt(M_PI)*exp(-alpha*alpha*d*d);
+        }
+
+        i=((((X+s->dx[j]%X)%X)*Y + (Y+s->dy[j]%Y)%Y)*Z + (Z+s->dz[j]%Z)%Z);
+        K[0][i]+=screen*s->rx[j]*s->invd3[j];
+        K[1][i]+=screen*s->ry[j]*s->invd3[j];
+        K[2][i]+=screen*s->rz[j]*s->invd3[j];
+    }
+}
+
+// Back transform the finished kernel, so the periodic (Ewald) kernel comes out
+// as the same lattice sum as the truncated one. Truncated: ~900 entries;
+// periodic: every site.
+static void potential_stencil_init()
+{
+    int a,i,x,y,z;
+    int sites=X*Y*Z;
+    double complex *K[3];
+
+    for (a=0;a<3;a++)
+    {
+        K[a]=(double complex *)malloc(sizeof(double complex)*sites);
+        memcpy(K[a],potential_kernel[a],sizeof(double complex)*sites);
+        fft3d(K[a],X,Y,Z,FFT_INVERSE);
+    }
+
+    potential_stencil=(struct stencil *)malloc(sizeof(struct stencil)*sites);
+    potential_stencil_n=0;
+    for (x=0;x<X;x++)
+        for (y=0;y<Y;y++)
+            for (z=0;z<Z;z++)
+            {
+                i=(x*Y+y)*Z+z;
+                if (cabs(K[0][i])+cabs(K[1][i])+cabs(K[2][i]) < 1e-9*sites) continue; // numerical zero
+                potential_stencil[potential_stencil_n].dx=x;
+                potential_stencil[potential_stencil_n].dy=y;
+                potential_stencil[potential_stencil_n].dz=z;
+                potential_stencil[potential_stencil_n].Kx=creal(K[0][i])/sites;
+                potential_stencil[potential_stencil_n].Ky=creal(K[1][i])/sites;
+                potential_stencil[potential_stencil_n].Kz=creal(K[2][i])/sites;
+                potential_stencil_n++;
+            }
+
+    for (a=0;a<3;a++) free(K[a]);
+    fprintf(stderr,"Incremental potential: %d site stencil\n",potential_stencil_n);
+}
+
+static void potential_kernel_init()
+{
+    int a,i,kx,ky,kz,jx,jy,jz;
+    int sites=X*Y*Z;
+    double alpha=1.0; // Ewald splitting; erfc(5 alpha) ~ 1e-12
+    double Gx,Gy,Gz,G2,w;
+    double complex rec[3];
+
+    for (a=0;a<3;a++)
+        potential_kernel[a]=(double complex *)calloc(sites,sizeof(double complex));
+    potential=(double *)malloc(sizeof(double)*sites);
+
+    if (!PotentialPeriodic)
+        potential_kernel_realspace(potential_kernel,6,0.0);
+    else
+        potential_kernel_realspace(potential_kernel,5,alpha);
+
+    for (a=0;a<3;a++)
+        fft3d(potential_kernel[a],X,Y,Z,FFT_FORWARD);
+
+    if (PotentialPeriodic)
+    {
+        // Reciprocal space part, straight into k-space. The DFT of the sampled
+        // smooth part is V*sum of its Fourier coefficients over aliases G:
+        //   K^_rec(k) = -4 pi i sum_G G exp(-G^2/4alpha^2)/G^2
+        for (kx=0;kx<X;kx++)
+            for (ky=0;ky<Y;ky++)
+                for (kz=0;kz<Z;kz++)
+                {
+                    rec[0]=rec[1]=rec[2]=0.0;
+                    for (jx=-3;jx<=3;jx++)
+                        for (jy=-3;jy<=3;jy++)
+                            for (jz=-3;jz<=3;jz++)
+                            {
+                                Gx=2.0*M_PI*((double)kx/X+jx);
+                                Gy=2.0*M_PI*((double)ky/Y+jy);
+                                Gz=2.0*M_PI*((double)kz/Z+jz);
+                                G2=Gx*Gx+Gy*Gy+Gz*Gz;
+                                if (G2==0.0) continue; // tin foil boundary
+                                w=-4.0*M_PI*exp(-G2/(4.0*alpha*alpha))/G2;
+                                rec[0]+=I*w*Gx; rec[1]+=I*w*Gy; rec[2]+=I*w*Gz;
+                            }
+                    i=(kx*Y+ky)*Z+kz;
+                    for (a=0;a<3;a++) potential_kernel[a][i]+=rec[a];
+                }
+    }
+
+    if (IncrementalPotential) potential_stencil_init();
+
+    // We need conj(K^); fold in the 1/N of the inverse transform while here
+    for (a=0;a<3;a++)
+        for (i=0;i<sites;i++)
+            potential_kernel[a][i]=conj(potential_kernel[a][i])/(double)sites;
+
+    fprintf(stderr,"Potential kernel: %s\n",PotentialPeriodic ? "full periodic (Ewald) sum" : "direct sum, cutoff 6");
+}
+
+// phi at every site, by FFT; returns the (global) potential array. Cached,
+// so any number of outputs of the same snapshot cost one evaluation.
+static double * lattice_potential()
+{
+    int a,i,x,y,z;
+    int sites=X*Y*Z;
+    double complex *p[3], *phi;
+    struct dipole *d;
+
+    if (potential_kernel[0]==NULL) potential_kernel_init();
+    if (potential_version==lattice_version) return(potential);
+
+    for (a=0;a<3;a++)
+        p[a]=(double complex *)malloc(sizeof(double complex)*sites);
+    phi=p[0]; // reused for the result
+
+    for (x=0;x<X;x++)
+        for (y=0;y<Y;y++)
+            for (z=0;z<Z;z++)
+            {
+                d=& lattice[x][y][z];
+                i=(x*Y+y)*Z+z;
+                p[0][i]=d->length*d->x;
+                p[1][i]=d->length*d->y;
+                p[2][i]=d->length*d->z;
+            }
+
+    for (a=0;a<3;a++)
+        fft3d(p[a],X,Y,Z,FFT_FORWARD);
+
+    for (i=0;i<sites;i++)
+        phi[i]=p[0][i]*potential_kernel[0][i] + p[1][i]*potential_kernel[1][i] + p[2][i]*potential_kernel[2][i];
+
+    fft3d(phi,X,Y,Z,FFT_INVERSE);
+
+    for (i=0;i<sites;i++)
+        potential[i]=creal(phi[i]);
+
+    for (a=0;a<3;a++) free(p[a]);
+    potential_version=lattice_version;
+    return(potential);
+}
+
+// Called by MC_accept() before the lattice site is overwritten. The dipole
+// at s contributes p(s).K(s-x) to phi(x), so its change scatters to the sites
+// x = s-r over the stencil. Only if phi is current; otherwise leave it stale
+// for lattice_potential() to recompute when next asked.
+static void potential_accept(int x, int y, int z, struct dipole *newdipole)
+{
+    int i;
+    double px,py,pz;
+    struct dipole *old=& lattice[x][y][z];
+    struct stencil *s;
+
+    if (potential_version!=lattice_version) return;
+
+    px=old->length*((double)newdipole->x-old->x); // in double; float rounding would drift
+    py=old->length*((double)newdipole->y-old->y);
+    pz=old->length*((double)newdipole->z-old->z);
+
+    for (i=0;i<potential_stencil_n;i++)
+    {
+        s=& potential_stencil[i];
+        potential[(((X+x-s->dx)%X)*Y + (Y+y-s->dy)%Y)*Z + (Z+z-s->dz)%Z] += px*s->Kx + py*s->Ky + pz*s->Kz;
+    }
+    potential_version=lattice_version+1; // current as of the move being committed
+}
+
+// Drift of the incrementally maintained phi vs. a full FFT recompute (which
+// then replaces it)
+static void potential_check(FILE *log)
+{
+    int i;
+    int sites=X*Y*Z;
+    double drift=0.0;
+    double *running;
+
+    if (potential_version!=lattice_version) return;
+
+    running=(double *)malloc(sizeof(double)*sites);
+    memcpy(running,potential,sizeof(double)*sites);
+    potential_version=ULONG_MAX;
+    lattice_potential();
+
+    for (i=0;i<sites;i++)
+        if (fabs(running[i]-potential[i])>drift) drift=fabs(running[i]-potential[i]);
+    free(running);
+
+    fprintf(stderr,"Potential check: max drift %e\n",drift);
+    fprintf(log,"# Potential check: moves %lu max drift %e\n",ACCEPT+REJECT,drift);
+}
@@ -0,0 +1,99 @@
+/* Starry Night - a Monte Carlo code to simulate ferroelectric domain formation
+ * and behaviour in hybrid perovskite solar cells.
+ *
+ * By Jarvist Moore Frost
+ * University of Bath
+ *
+ * File begun 16th January 2014
+ */
+
+// Cadence of the megastep outputs. Each observable (table in -config) runs at
+// most every <name>Interval sweeps (0: every megastep), and if <name>Budget
+// is set, its interval is doubled whenever its running total cost exceeds
+// that fraction of the wall time, and halved back (to no less than asked)
+// once it is under half of it. Every output is recorded in
+// Schedule_T_xxxx.dat, with the sweep it corresponds to and what it cost.
+//
+// What is due is decided in analysis_midpoint(), so holds for asynchronous
+// snapshots too; but their costs are measured in the child, so the budgets
+// only adapt for analysis done in line.
+
+#include <time.h>
+
+// Prototypes...
+static double wall_time();
+static void schedule_init(char * filename);
+static void schedule_plan();
+static int schedule_start(int o);
+static void schedule_stop(int o);
+
+FILE *schedulelog=NULL;
+double schedule_t0=0.0; // wall time at schedule_init()
+double schedule_tstart=0.0; // of the observable being timed
+
+static double wall_time()
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC,&t);
+    return(t.tv_sec+1e-9*t.tv_nsec);
+}
+
+static void schedule_init(char * filename)
+{
+    int o;
+
+    for (o=0;o<OBSERVABLES;o++)
+    {
+        observables[o].effective=observables[o].interval;
+        observables[o].last=-1.0;
+        observables[o].cost=0.0;
+    }
+    schedule_t0=wall_time();
+
+    schedulelog=fopen(filename,"w");
+    fprintf(schedulelog,"# Schedule T: %d\n# moves sweep observable cost(s) interval(sweeps)\n",T);
+}
+
+// Once per megastep, in the MC process: mark what is due
+static void schedule_plan()
+{
+    int o;
+    double sweep=(double)(ACCEPT+REJECT)/(X*Y*Z);
+    struct observable *ob;
+
+    for (o=0;o<OBSERVABLES;o++)
+    {
+        ob=& observables[o];
+        ob->due= ob->last<0.0 || sweep-ob->last >= ob->effective;
+        if (ob->due) ob->last=sweep;
+    }
+}
+
+// True if observable o is due now; if so, starts its clock
+static int schedule_start(int o)
+{
+    if (!observables[o].due) return(false);
+    schedule_tstart=wall_time();
+    return(true);
+}
+
+static void schedule_stop(int o)
+{
+    struct observable *ob=& observables[o];
+    double cost=wall_time()-schedule_tstart;
+    double elapsed=wall_time()-schedule_t0;
+    double megastep=MCMinorSteps/(double)(X*Y*Z); // sweeps
+
+    ob->cost+=cost;
+    if (schedulelog!=NULL)
+        fprintf(schedulelog,"%lu %f %s %f %f\n",ACCEPT+REJECT,ob->last,ob->name,cost,ob->effective);
+
+    if (ob->budget<=0.0 || elapsed<=0.0) return;
+    if (ob->cost > ob->budget*elapsed) // over budget: back off
+        ob->effective=ob->effective>0.0 ? 2.0*ob->effective : 2.0*megastep;
+    else if (ob->cost < 0.5*ob->budget*elapsed && ob->effective > ob->interval)
+    {
+        ob->effective/=2.0;
+        if (ob->effective < ob->interval || ob->effective < megastep) ob->effective=ob->interval;
+    }
+}
@@ -0,0 +1,111 @@
+/* Starry Night - a Monte Carlo code to simulate ferroelectric domain formation
+ * and behaviour in hybrid perovskite solar cells.
+ *
+ * By Jarvist Moore Frost
+ * University of Bath
+ *
+ * File begun 16th January 2014
+ */
+
+// Spherical stencils: every displacement within a cutoff, with its geometry
+// worked out once. The kernels (MC neighbour list, potential, electric field,
+// radial order parameter) all walk one of these, rather than each looping
+// over the cube with a sqrt and a cutoff test per entry. Built on first use, then kept, per (cutoff, type):
+//  STENCIL_SITE    r=(dx,dy,dz), |r|<=cutoff; entry 0 is r=0 (d, n, T zero),
+//                  so sums that exclude self interaction start at 1
+//  STENCIL_OFFSET  r=(dx,dy,dz)+1/2, |r|<=cutoff; the dipoles about a point of
+//                  the dual lattice, half a lattice vector from the site
+// in the loop order of the old direct sums (dx, dy, then dz), so sums come
+// out in the same order. Stored as arrays (not an array of structs), so a
+// loop over one or two of them is contiguous.
+
+enum {STENCIL_SITE, STENCIL_OFFSET};
+enum {TXX,TYY,TZZ,TXY,TXZ,TYZ}; // symmetric tensor components
+
+struct sphere
+{
+    int cutoff,type;
+    int n;
+    int *dx,*dy,*dz; // lattice displacement
+    double *rx,*ry,*rz; // separation
+    float *d; // |r|; float, as the direct sums always were
+    double *nx,*ny,*nz; // r/|r|
+    double *invd3; // 1/|r|^3
+    double *T[6]; // dipole tensor (3 n_a n_b - delta_ab)/|r|^3
+    int *shell; // |r|^2 (SITE), 4|r|^2 (OFFSET); an integer, for binning
+};
+
+// Prototypes...
+static struct sphere * sphere_stencil(int cutoff, int type);
+
+struct sphere **spheres=NULL; // all built, each kept for the run
+int sphere_count=0;
+
+static void sphere_add(struct sphere *s, int dx, int dy, int dz)
+{
+    int i=s->n++;
+    double h= s->type==STENCIL_OFFSET ? 0.5 : 0.0;
+    double d3;
+
+    s->dx[i]=dx; s->dy[i]=dy; s->dz[i]=dz;
+    s->rx[i]=dx+h; s->ry[i]=dy+h; s->rz[i]=dz+h;
+    s->d[i]=sqrt((float) s->rx[i]*s->rx[i] + s->ry[i]*s->ry[i] + s->rz[i]*s->rz[i]);
+    s->shell[i]= s->type==STENCIL_OFFSET ? (2*dx+1)*(2*dx+1)+(2*dy+1)*(2*dy+1)+(2*dz+1)*(2*dz+1)
+        : dx*dx+dy*dy+dz*dz;
+
+    if (s->d[i]==0.0) // self; no infinities please
+    {
+        s->nx[i]=s->ny[i]=s->nz[i]=s->invd3[i]=0.0;
+        s->T[TXX][i]=s->T[TYY][i]=s->T[TZZ][i]=s->T[TXY][i]=s->T[TXZ][i]=s->T[TYZ][i]=0.0;
+        return;
+    }
+    s->nx[i]=s->rx[i]/s->d[i]; s->ny[i]=s->ry[i]/s->d[i]; s->nz[i]=s->rz[i]/s->d[i];
+    d3=(double)s->d[i]*s->d[i]*s->d[i];
+    s->invd3[i]=1.0/d3;
+    s->T[TXX][i]=(3*s->nx[i]*s->nx[i]-1.0)/d3;
+    s->T[TYY][i]=(3*s->ny[i]*s->ny[i]-1.0)/d3;
+    s->T[TZZ][i]=(3*s->nz[i]*s->nz[i]-1.0)/d3;
+    s->T[TXY][i]=3*s->nx[i]*s->ny[i]/d3;
+    s->T[TXZ][i]=3*s->nx[i]*s->nz[i]/d3;
+    s->T[TYZ][i]=3*s->ny[i]*s->nz[i]/d3;
+}
+
+static struct sphere * sphere_stencil(int cutoff, int type)
+{
+    struct sphere *s;
+    int i,dx,dy,dz,lo,hi,max;
+    float d,h;
+
+    for (i=0;i<sphere_count;i++)
+        if (spheres[i]->cutoff==cutoff && spheres[i]->type==type) return(spheres[i]);
+
+    // the offset sphere about x-(1/2,1/2,1/2) spans dx = -cutoff..cutoff-1
+    lo=-cutoff; hi= type==STENCIL_OFFSET ? cutoff-1 : cutoff;
+    h= type==STENCIL_OFFSET ? 0.5 : 0.0;
+    max=(hi-lo+1)*(hi-lo+1)*(hi-lo+1);
+
+    s=(struct sphere *)malloc(sizeof(struct sphere));
+    s->cutoff=cutoff; s->type=type; s->n=0;
+    s->dx=(int *)malloc(sizeof(int)*max); s->dy=(int *)malloc(sizeof(int)*max); s->dz=(int *)malloc(sizeof(int)*max);
+    s->rx=(double *)malloc(sizeof(double)*max); s->ry=(double *)malloc(sizeof(double)*max); s->rz=(double *)malloc(sizeof(double)*max);
+    s->d=(float *)malloc(sizeof(float)*max);
+    s->nx=(double *)malloc(sizeof(double)*max); s->ny=(double *)malloc(sizeof(double)*max); s->nz=(double *)malloc(sizeof(double)*max);
+    s->invd3=(double *)malloc(sizeof(double)*max);
+    for (i=0;i<6;i++) s->T[i]=(double *)malloc(sizeof(double)*max);
+    s->shell=(int *)malloc(sizeof(int)*max);
+
+    if (type==STENCIL_SITE) sphere_add(s,0,0,0);
+    for (dx=lo;dx<=hi;dx++)
+        for (dy=lo;dy<=hi;dy++)
+            for (dz=lo;dz<=hi;dz++)
+            {
+                if (type==STENCIL_SITE && dx==0 && dy==0 && dz==0) continue; // already entry 0
+                d=sqrt((float) (dx+h)*(dx+h) + (dy+h)*(dy+h) + (dz+h)*(dz+h)); //that old chestnut
+                if (d>(float)cutoff) continue; // Cutoff in d
+                sphere_add(s,dx,dy,dz);
+            }
+
+    spheres=(struct sphere **)realloc(spheres,sizeof(struct sphere *)*(sphere_count+1));
+    spheres[sphere_count++]=s;
+    return(s);
+}
@@ -0,0 +1,269 @@
+/* Starry Night - a Monte Carlo code to simulate ferroelectric domain formation
+ * and behaviour in hybrid perovskite solar cells.
+ *
+ * By Jarvist Moore Frost
+ * University of Bath
+ *
+ * File begun 16th January 2014
+ */
+
+// Terminal display ("Party like it's 1980"). A picture is composed as a grid
+// of cells (a character and its colours), then written to stderr in one
+// write(), with an escape sequence only where the colour changes.
+//  - TerminalInPlace: with stderr a terminal large enough, the lattice
+//    display is pinned to the top of the screen, the log scrolling beneath it
+//    (a scroll region), and only the cells changed since the last frame are
+//    redrawn. Otherwise (a file, a small terminal) frames scroll, as ever.
+//  - TerminalFPS: at most this many frames a second (wall clock); the others
+//    are skipped before they are composed. A skipped final frame is drawn by
+//    terminal_close().
+// The frame on screen (and the clock) are in shared memory, so that the
+// analysis children of AsyncAnalysis diff against their predecessor's frame.
+
+#include <signal.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+
+struct termcell
+{
+    char c;
+    signed char fg; // 30..37; 0 default
+    char reverse;
+    short bg; // xterm 256 colour; -1 default
+};
+
+struct termframe
+{
+    int rows,cols;
+    struct termcell *cells; // being composed
+    struct termcell *shown; // on screen (in place), or NULL: scrolls
+};
+
+enum {TERM_LATTICE, TERM_RECOMBINATION, TERM_PICTURES};
+
+struct terminal_shared
+{
+    double drawn[TERM_PICTURES]; // wall clock of the last frame of each
+    int pending; // a lattice frame has been skipped since
+};
+
+// Prototypes...
+static int terminal_due(int picture);
+static struct termframe * terminal_frame(int picture);
+static void terminal_text(struct termframe *f, int row, int col, const char *s);
+static void terminal_cell(struct termframe *f, int row, int col, char c, int fg, int reverse, int bg);
+static void terminal_draw(struct termframe *f, int picture);
+static void terminal_close();
+void outputlattice_dumb_terminal(); // in analysis
+
+struct
+{
+    int open;
+    int inplace;
+    int screenrows; // of the terminal, in place
+    int force; // draw, whatever the rate
+    struct termframe frame[TERM_PICTURES];
+    struct terminal_shared *shared;
+} terminal={0};
+
+static double terminal_clock()
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC,&t);
+    return(t.tv_sec+1e-9*t.tv_nsec);
+}
+
+// Undo the scroll region; also on the way out of an interrupted run
+static void terminal_restore()
+{
+    if (terminal.inplace) write(STDERR_FILENO,"\033[r\033[999;1H\n",12);
+}
+
+static void terminal_interrupt(int sig)
+{
+    terminal_restore();
+    signal(sig,SIG_DFL);
+    raise(sig);
+}
+
+static void terminal_open()
+{
+    struct winsize w;
+    const char *term=getenv("TERM");
+    int cols=4*X+4>80 ? 4*X+4 : 80; // dipoles, gap, potential; or the text lines
+    int lattice=Y+2; // label, rows, statistics
+    int i,n;
+    struct termframe *f;
+
+    terminal.open=true;
+    terminal.inplace=DisplayDumbTerminal && TerminalInPlace && isatty(STDERR_FILENO)
+        && (term==NULL || strcmp(term,"dumb")!=0)
+        && ioctl(STDERR_FILENO,TIOCGWINSZ,&w)==0
+        && w.ws_col>=cols && w.ws_row>=lattice+4; // room for a few lines of log
+
+    n=lattice*cols;
+    terminal.shared=(struct terminal_shared *)mmap(NULL,sizeof(struct terminal_shared)+sizeof(struct termcell)*n,
+            PROT_READ|PROT_WRITE,MAP_SHARED|MAP_ANONYMOUS,-1,0);
+    if (terminal.shared==MAP_FAILED) // no sharing; children's frames then not diffed against
+    {
+        terminal.shared=(struct terminal_shared *)malloc(sizeof(struct terminal_shared));
+        terminal.inplace=false;
+    }
+    for (i=0;i<TERM_PICTURES;i++) terminal.shared->drawn[i]=-INFINITY;
+    terminal.shared->pending=false;
+
+    f=&terminal.frame[TERM_LATTICE];
+    f->rows=lattice; f->cols=cols;
+    f->cells=(struct termcell *)malloc(sizeof(struct termcell)*n);
+    f->shown=NULL;
+    if (terminal.inplace)
+    {
+        f->shown=(struct termcell *)(terminal.shared+1);
+        for (i=0;i<n;i++) f->shown[i]=(struct termcell){' ',0,0,-1}; // as the cleared screen
+        terminal.screenrows=w.ws_row;
+        // clear; log scrolls below the display; cursor to the top of the log
+        fprintf(stderr,"\033[2J\033[%d;%dr\033[%d;1H",lattice+1,w.ws_row,lattice+1);
+        atexit(terminal_restore);
+        signal(SIGINT,terminal_interrupt);
+        signal(SIGTERM,terminal_interrupt);
+    }
+
+    f=&terminal.frame[TERM_RECOMBINATION]; // always scrolls, with the log
+    f->rows=2*Y+4; f->cols=cols;
+    f->cells=(struct termcell *)malloc(sizeof(struct termcell)*f->rows*f->cols);
+    f->shown=NULL;
+}
+
+// Whether to draw this picture now; if not, skip composing it too
+static int terminal_due(int picture)
+{
+    double now=terminal_clock();
+
+    if (!terminal.open) terminal_open();
+    if (terminal.force || TerminalFPS<=0.0 || now-terminal.shared->drawn[picture]>=1.0/TerminalFPS)
+        return(true);
+    if (picture==TERM_LATTICE) terminal.shared->pending=true;
+    return(false);
+}
+
+// A blank frame to compose the picture into
+static struct termframe * terminal_frame(int picture)
+{
+    struct termframe *f=&terminal.frame[picture];
+    int i;
+
+    for (i=0;i<f->rows*f->cols;i++) f->cells[i]=(struct termcell){' ',0,0,-1};
+    return(f);
+}
+
+// Plain text; clipped at the edge of the frame
+static void terminal_text(struct termframe *f, int row, int col, const char *s)
+{
+    for (;*s && col<f->cols;s++,col++)
+        f->cells[row*f->cols+col]=(struct termcell){*s,0,0,-1};
+}
+
+static void terminal_cell(struct termframe *f, int row, int col, char c, int fg, int reverse, int bg)
+{
+    if (col<f->cols) f->cells[row*f->cols+col]=(struct termcell){c,fg,reverse,bg};
+}
+
+// Same colours
+static int termcell_style(struct termcell *a, struct termcell *b)
+{
+    return(a->fg==b->fg && a->reverse==b->reverse && a->bg==b->bg);
+}
+
+// Escape sequence to the style of cell c
+static char * termcell_sgr(char *p, struct termcell *c)
+{
+    p+=sprintf(p,"\033[0");
+    if (c->fg) p+=sprintf(p,";%d",c->fg);
+    if (c->reverse) p+=sprintf(p,";7");
+    if (c->bg>=0) p+=sprintf(p,";48;5;%d",c->bg);
+    *p++='m';
+    return(p);
+}
+
+// The frame to stderr, in one write: whole (trailing blanks trimmed), or just
+// the cells that differ from those shown
+static void terminal_draw(struct termframe *f, int picture)
+{
+    struct textbuffer b={NULL,0,0};
+    struct termcell plain={' ',0,0,-1},style=plain,*cell;
+    int r,c,last,atrow=-1,atcol=-1;
+    char *p;
+
+    for (r=0;r<f->rows;r++)
+    {
+        if (f->shown==NULL)
+            for (last=f->cols-1;last>=0 && f->cells[r*f->cols+last].c==' '
+                    && termcell_style(&f->cells[r*f->cols+last],&plain);last--);
+        else
+            last=f->cols-1;
+
+        p=text_reserve(&b,TEXT_LINE+32*(size_t)(last+1));
+        if (f->shown!=NULL && r==0) p+=sprintf(p,"\0337"); // save the cursor, in the log
+        for (c=0;c<=last;c++)
+        {
+            cell=&f->cells[r*f->cols+c];
+            if (f->shown!=NULL)
+            {
+                if (cell->c==f->shown[r*f->cols+c].c && termcell_style(cell,&f->shown[r*f->cols+c])) continue;
+                if (r!=atrow || c!=atcol) p+=sprintf(p,"\033[%d;%dH",r+1,c+1);
+                f->shown[r*f->cols+c]=*cell;
+                atrow=r; atcol=c+1;
+            }
+            if (!termcell_style(cell,&style))
+            {
+                p=termcell_sgr(p,cell);
+                style=*cell;
+            }
+            *p++=cell->c;
+        }
+        if (f->shown==NULL)
+        {
+            if (!termcell_style(&style,&plain)) p+=sprintf(p,"\033[0m");
+            style=plain;
+            *p++='\n';
+        }
+        b.n=p-b.p;
+    }
+    if (f->shown!=NULL)
+    {
+        p=text_reserve(&b,16);
+        p+=sprintf(p,"\033[0m\0338"); // back to the log
+        b.n=p-b.p;
+    }
+
+    fflush(stderr);
+    for (p=b.p;p<b.p+b.n;) // one write(), unless interrupted
+    {
+        ssize_t done=write(STDERR_FILENO,p,b.p+b.n-p);
+        if (done<=0) break;
+        p+=done;
+    }
+    free(b.p);
+
+    terminal.shared->drawn[picture]=terminal_clock();
+    if (picture==TERM_LATTICE) terminal.shared->pending=false;
+}
+
+// The last lattice frame, if it was skipped; then leave the screen be
+static void terminal_close()
+{
+    if (!terminal.open) return;
+    if (terminal.shared->pending)
+    {
+        terminal.force=true;
+        outputlattice_dumb_terminal();
+        terminal.force=false;
+    }
+    if (terminal.inplace)
+    {
+        fprintf(stderr,"\033[r\033[%d;1H",terminal.screenrows); // whole screen scrolls again
+        terminal.inplace=false;
+    }
+}
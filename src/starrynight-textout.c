@@ -0,0 +1,189 @@
+/* Starry Night - a Monte Carlo code to simulate ferroelectric domain formation
+ * and behaviour in hybrid perovskite solar cells.
+ *
+ * By Jarvist Moore Frost
+ * University of Bath
+ *
+ * File begun 16th January 2014
+ */
+
+// Buffered text output, for the large text formats (XYZ, cube, PNM). Rather
+// than an fprintf() a value, each x slab is formatted into its own buffer by
+// its own thread (OpenMP), and the buffers written in order; a thread's worth
+// of slabs at a time, so the memory is bounded. The number formatters are
+// integer arithmetic, so many times faster than printf():
+//  text_fixed()  as "%.*f" (up to 9 places)
+//  text_exp()    as "%.*E" (up to 15 places); for the cube files
+//  text_int()    as "%d"
+// The same digits as printf(), ties included: the one inexact step (scaling
+// by a power of ten) is corrected with fma(), so rounding is decided on the
+// exact value. Values out of range (huge, tiny, inf, nan) use snprintf().
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+enum {TEXT_LINE=1024}; // reserve for a line; a printf("%f") of DBL_MAX is ~320
+
+struct textbuffer
+{
+    char *p;
+    size_t n,size;
+};
+
+// Prototypes...
+static char * text_reserve(struct textbuffer *b, size_t more);
+static char * text_int(char *p, int v);
+static char * text_fixed(char *p, double v, int decimals);
+static char * text_exp(char *p, double v, int decimals);
+static void text_slabs(FILE *fo, int slabs, void (*format)(struct textbuffer *b, int slab, void *arg), void *arg);
+
+static const double text_pow10[]={1e0,1e1,1e2,1e3,1e4,1e5,1e6,1e7,1e8,1e9,
+    1e10,1e11,1e12,1e13,1e14,1e15,1e16,1e17,1e18,1e19,1e20,1e21,1e22}; // all exact
+
+// Room for at least another 'more' bytes; returns the end of the text
+static char * text_reserve(struct textbuffer *b, size_t more)
+{
+    if (b->n+more > b->size)
+    {
+        b->size=2*(b->n+more);
+        b->p=(char *)realloc(b->p,b->size);
+    }
+    return(b->p+b->n);
+}
+
+// Digits of u, at least 'width' of them (zero padded)
+static char * text_digits(char *p, unsigned long long u, int width)
+{
+    char d[24];
+    int n=0;
+
+    do { d[n++]='0'+u%10; u/=10; } while (u>0 || n<width);
+    while (n>0) *p++=d[--n];
+    return(p);
+}
+
+static char * text_int(char *p, int v)
+{
+    if (v<0) { *p++='-'; return(text_digits(p,-(long long)v,1)); }
+    return(text_digits(p,v,1));
+}
+
+// a*10^k (|k|<=22), and in err the sign of what rounding it lost
+static double text_scale(double a, int k, double *err)
+{
+    double r;
+
+    if (k>=0)
+    {
+        r=a*text_pow10[k];
+        *err=fma(a,text_pow10[k],-r);
+    }
+    else
+    {
+        r=a/text_pow10[-k];
+        *err=fma(-r,text_pow10[-k],a);
+    }
+    return(r);
+}
+
+// r to the nearest integer; a tie in r is decided by err, the exact value
+// being above or below it; an exact tie to even (as printf())
+static unsigned long long text_round(double r, double err)
+{
+    unsigned long long f=(unsigned long long)floor(r);
+    double d=r-floor(r);
+
+    if (d>0.5 || (d==0.5 && (err>0.0 || (err==0.0 && (f&1))))) f++;
+    return(f);
+}
+
+static char * text_fixed(char *p, double v, int decimals)
+{
+    double a=fabs(v),ip,r,err;
+    unsigned long long i,f;
+
+    if (!(a<1e15) || decimals<0 || decimals>9)
+        return(p+snprintf(p,TEXT_LINE,"%.*f",decimals,v));
+
+    // integer and fractional parts separately (a-floor(a) is exact)
+    ip=floor(a);
+    i=(unsigned long long)ip;
+    r=text_scale(a-ip,decimals,&err);
+    f=text_round(r,err);
+    if (f>=(unsigned long long)text_pow10[decimals]) { i++; f=0; } // rounded up to the next integer
+
+    if (signbit(v)) *p++='-'; // as printf(): "-0.000000" for a tiny negative
+    p=text_digits(p,i,1);
+    if (decimals>0)
+    {
+        *p++='.';
+        p=text_digits(p,f,decimals);
+    }
+    return(p);
+}
+
+static char * text_exp(char *p, double v, int decimals)
+{
+    double a=fabs(v),r,err;
+    unsigned long long m,lo,hi;
+    int e=0;
+
+    if (a!=0.0) // floor(log10(a)), or one less; from the binary exponent
+    {
+        frexp(a,&e);
+        e=(int)floor((e-1)*0.30102999566398120);
+    }
+    if (!isfinite(a) || decimals<0 || decimals>15 || abs(decimals-e)>21)
+        return(p+snprintf(p,TEXT_LINE,"%.*E",decimals,v));
+
+    lo=(unsigned long long)text_pow10[decimals]; hi=10*lo; // mantissa digits in [lo,hi)
+    if (a==0.0) m=0;
+    else
+    {
+        r=text_scale(a,decimals-e,&err);
+        if (r>=hi) { e++; r=text_scale(a,decimals-e,&err); } // the one less
+        m=text_round(r,err);
+        if (m>=hi) { e++; m/=10; } // 9.99.. rounded up to 10
+    }
+
+    if (signbit(v)) *p++='-';
+    *p++='0'+m/lo;
+    if (decimals>0)
+    {
+        *p++='.';
+        p=text_digits(p,m%lo,decimals);
+    }
+    *p++='E';
+    *p++= e<0 ? '-' : '+';
+    return(text_digits(p,abs(e),2));
+}
+
+// format(b,slab,arg) appends the text of one slab to b; slabs are formatted
+// in parallel, written in order
+static void text_slabs(FILE *fo, int slabs, void (*format)(struct textbuffer *b, int slab, void *arg), void *arg)
+{
+    int threads=1,s0,s,n;
+    struct textbuffer *b;
+
+#ifdef _OPENMP
+    threads=omp_get_max_threads();
+#endif
+    b=(struct textbuffer *)calloc(threads,sizeof(struct textbuffer));
+
+    for (s0=0;s0<slabs;s0+=threads)
+    {
+        n= slabs-s0<threads ? slabs-s0 : threads;
+#pragma omp parallel for schedule(static,1)
+        for (s=0;s<n;s++)
+        {
+            b[s].n=0;
+            format(&b[s],s0+s,arg);
+        }
+        for (s=0;s<n;s++)
+            fwrite(b[s].p,1,b[s].n,fo);
+    }
+
+    for (s=0;s<threads;s++) free(b[s].p);
+    free(b);
+}
@@ -0,0 +1,214 @@
+/* Starry Night - a Monte Carlo code to simulate ferroelectric domain formation
+ * and behaviour in hybrid perovskite solar cells.
+ *
+ * By Jarvist Moore Frost
+ * University of Bath
+ *
+ * File begun 16th January 2014
+ */
+
+// starrynight-traj - reads the Trajectory_T_xxxx.traj files written with
+// SaveTrajectory: true (format in starrynight-trajectory.c).
+//
+// With just the file, prints the header and the frame list. With a frame
+// number, seeks (by the index) to that frame's key frame, replays the deltas
+// up to it, and prints the lattice: x y z px py pz length, one site a line.
+// Files without an index (the run didn't finish) are scanned in sequence.
+//
+// Usage: ./starrynight-traj Trajectory_T_0300.traj [frame] > frame.dat
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+
+struct frame
+{
+    int64_t offset, key;
+    uint64_t moves;
+    int32_t type, count;
+};
+
+struct
+{
+    int32_t X,Y,Z,T,DIM,DipoleCutOff,ConstrainToX,TrajectoryInterval;
+    double CageStrain,K;
+    float Efield[3];
+    int32_t species;
+    float length[256], prevalence[256];
+    unsigned char *site; // species of every site
+    int64_t frames_start; // offset of the first frame
+} header;
+
+static void die(char * message)
+{
+    fprintf(stderr,"starrynight-traj: %s\n",message);
+    exit(EXIT_FAILURE);
+}
+
+static void read_or_die(void *p, size_t size, size_t n, FILE *fi)
+{
+    if (fread(p,size,n,fi)!=n) die("unexpected end of file");
+}
+
+static void read_header(FILE *fi)
+{
+    char magic[8];
+    int32_t i32[8];
+    int i,sites;
+
+    read_or_die(magic,1,8,fi);
+    if (memcmp(magic,"SNTRAJ01",8)!=0) die("not a StarryNight trajectory");
+    read_or_die(i32,sizeof(int32_t),8,fi);
+    header.X=i32[0]; header.Y=i32[1]; header.Z=i32[2]; header.T=i32[3];
+    header.DIM=i32[4]; header.DipoleCutOff=i32[5]; header.ConstrainToX=i32[6]; header.TrajectoryInterval=i32[7];
+    read_or_die(&header.CageStrain,sizeof(double),1,fi);
+    read_or_die(&header.K,sizeof(double),1,fi);
+    read_or_die(header.Efield,sizeof(float),3,fi);
+    read_or_die(&header.species,sizeof(int32_t),1,fi);
+    if (header.species<0 || header.species>255) die("bad species table");
+    for (i=0;i<header.species;i++)
+    {
+        read_or_die(&header.length[i],sizeof(float),1,fi);
+        read_or_die(&header.prevalence[i],sizeof(float),1,fi);
+    }
+    sites=header.X*header.Y*header.Z;
+    header.site=(unsigned char *)malloc(sites);
+    read_or_die(header.site,1,sites,fi);
+    header.frames_start=ftell(fi);
+}
+
+// Frame header at the current position; leaves the file at its payload
+static int read_frame_header(FILE *fi, struct frame *f)
+{
+    char magic[4];
+
+    f->offset=ftell(fi);
+    if (fread(magic,1,4,fi)!=4 || memcmp(magic,"FRAM",4)!=0) return(0);
+    read_or_die(&f->type,sizeof(int32_t),1,fi);
+    read_or_die(&f->moves,sizeof(uint64_t),1,fi);
+    read_or_die(&f->count,sizeof(int32_t),1,fi);
+    return(1);
+}
+
+// Frame list from the index; else by scanning the frames in sequence
+static struct frame * read_index(FILE *fi, int *n)
+{
+    char magic[8];
+    int64_t offset,key=-1;
+    int32_t frames;
+    struct frame *f=NULL;
+    int i,size=0;
+
+    fseek(fi,-16,SEEK_END);
+    if (fread(&offset,sizeof(int64_t),1,fi)==1 && fread(magic,1,8,fi)==8 && memcmp(magic,"SNTRAJIX",8)==0)
+    {
+        fseek(fi,offset+4,SEEK_SET); // past "INDX"
+        read_or_die(&frames,sizeof(int32_t),1,fi);
+        f=(struct frame *)malloc(sizeof(struct frame)*(frames>0 ? frames : 1));
+        for (i=0;i<frames;i++)
+        {
+            read_or_die(&f[i].offset,sizeof(int64_t),1,fi);
+            read_or_die(&f[i].key,sizeof(int64_t),1,fi);
+            read_or_die(&f[i].moves,sizeof(uint64_t),1,fi);
+            read_or_die(&f[i].type,sizeof(int32_t),1,fi);
+            read_or_die(&f[i].count,sizeof(int32_t),1,fi);
+        }
+        *n=frames;
+        return(f);
+    }
+
+    fprintf(stderr,"starrynight-traj: no index; scanning frames\n");
+    fseek(fi,header.frames_start,SEEK_SET);
+    for (*n=0;;(*n)++)
+    {
+        if (*n==size) // grow
+        {
+            size=size ? 2*size : 1024;
+            f=(struct frame *)realloc(f,sizeof(struct frame)*size);
+        }
+        if (!read_frame_header(fi,&f[*n])) break;
+        if (f[*n].type==0) key=f[*n].offset;
+        f[*n].key=key;
+        if (fseek(fi,(long)f[*n].count*(f[*n].type==0 ? 12 : 16),SEEK_CUR)!=0) break;
+    }
+    return(f);
+}
+
+// Orientations at frame k: from its key frame, plus the deltas up to k
+static float * read_lattice(FILE *fi, struct frame *f, int k)
+{
+    int sites=header.X*header.Y*header.Z;
+    float *p=(float *)malloc(sizeof(float)*3*sites);
+    struct frame g;
+    int32_t site;
+    int i,j;
+
+    for (j=k;j>0 && f[j].offset!=f[k].key;j--); // index of the key frame
+    if (f[j].type!=0) die("no key frame before this frame");
+
+    for (;j<=k;j++)
+    {
+        fseek(fi,f[j].offset,SEEK_SET);
+        if (!read_frame_header(fi,&g)) die("bad frame");
+        if (g.type==0)
+            read_or_die(p,sizeof(float),3*sites,fi);
+        else
+            for (i=0;i<g.count;i++)
+            {
+                read_or_die(&site,sizeof(int32_t),1,fi);
+                if (site<0 || site>=sites) die("bad site in delta frame");
+                read_or_die(&p[3*site],sizeof(float),3,fi);
+            }
+    }
+    return(p);
+}
+
+int main(int argc, char *argv[])
+{
+    FILE *fi;
+    struct frame *f;
+    int i,n,k,x,y,z;
+    float *p,length;
+
+    if (argc<2)
+    {
+        fprintf(stderr,"Usage: %s Trajectory_T_xxxx.traj [frame]\n",argv[0]);
+        return(EXIT_FAILURE);
+    }
+    fi=fopen(argv[1],"rb");
+    if (fi==NULL) die("can't open trajectory");
+
+    read_header(fi);
+    f=read_index(fi,&n);
+
+    if (argc<3)
+    {
+        printf("# X: %d Y: %d Z: %d T: %d DIM: %d DipoleCutOff: %d ConstrainToX: %d TrajectoryInterval: %d\n",
+                header.X,header.Y,header.Z,header.T,header.DIM,header.DipoleCutOff,header.ConstrainToX,header.TrajectoryInterval);
+        printf("# CageStrain: %f K: %f Efield: %f %f %f\n",header.CageStrain,header.K,header.Efield[0],header.Efield[1],header.Efield[2]);
+        for (i=0;i<header.species;i++)
+            printf("# species %d length: %f prevalence: %f\n",i,header.length[i],header.prevalence[i]);
+        printf("# frame moves type(0 key, 1 delta) sites offset\n");
+        for (i=0;i<n;i++)
+            printf("%d %llu %d %d %lld\n",i,(unsigned long long)f[i].moves,f[i].type,f[i].count,(long long)f[i].offset);
+        return(0);
+    }
+
+    k=atoi(argv[2]);
+    if (k<0 || k>=n) die("no such frame");
+    p=read_lattice(fi,f,k);
+
+    printf("# frame: %d moves: %llu\n# x y z px py pz length\n",k,(unsigned long long)f[k].moves);
+    for (x=0;x<header.X;x++)
+        for (y=0;y<header.Y;y++)
+            for (z=0;z<header.Z;z++)
+            {
+                i=(x*header.Y+y)*header.Z+z;
+                length=header.site[i]==255 ? 0.0 : header.length[header.site[i]];
+                printf("%d %d %d %f %f %f %f\n",x,y,z,p[3*i],p[3*i+1],p[3*i+2],length);
+            }
+
+    fclose(fi);
+    return(0);
+}
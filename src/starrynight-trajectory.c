@@ -0,0 +1,221 @@
+/* Starry Night - a Monte Carlo code to simulate ferroelectric domain formation
+ * and behaviour in hybrid perovskite solar cells.
+ *
+ * By Jarvist Moore Frost
+ * University of Bath
+ *
+ * File begun 16th January 2014
+ */
+
+// Binary trajectory, for dynamics: a frame every TrajectoryInterval sweeps.
+// Native byte order (as the other .bin outputs); read with starrynight-traj.
+//
+//  header  "SNTRAJ01", int32 X Y Z T DIM DipoleCutOff ConstrainToX
+//          TrajectoryInterval, double CageStrain K, float Efield x y z,
+//          int32 species, species x {float length prevalence},
+//          uint8 species of every site (255: empty), site order (x*Y+y)*Z+z
+//  frames  "FRAM", int32 type (0 key, 1 delta), uint64 moves, int32 count,
+//          key:   count(=sites) x float {x y z}
+//          delta: count x {int32 site, float x y z}; sites changed since the
+//                 previous frame
+//  index   "INDX", int32 frames, frames x {int64 offset, int64 key offset,
+//          uint64 moves, int32 type, int32 count}
+//  trailer int64 index offset, "SNTRAJIX"
+//
+// Changed sites are flagged by MC_accept(), so a delta frame costs only the
+// sites that moved. A key frame is written every TrajectoryKeyframe frames
+// (so any frame is a seek to its key frame, plus a bounded replay), or
+// whenever the delta would be the larger. Without the index (a run that
+// didn't finish), the frames can still be read in sequence.
+
+#include <stdint.h>
+
+// Prototypes...
+static void trajectory_open(char * filename);
+static void trajectory_accept(int x, int y, int z);
+static void trajectory_sample();
+static void trajectory_frame();
+static void trajectory_close();
+
+struct trajectory_index
+{
+    int64_t offset, key;
+    uint64_t moves;
+    int32_t type, count;
+};
+
+struct
+{
+    FILE *fo;
+    struct trajectory_index *index;
+    int n,size; // frames
+    int64_t key; // offset of the last key frame
+    int sincekey; // frames since it
+    int sweeps; // since the last frame
+    unsigned char *changed; // per site, since the last frame
+    int32_t *changedlist;
+    int nchanged;
+} trajectory={NULL};
+
+static void trajectory_open(char * filename)
+{
+    int32_t i32[8];
+    double f64[2];
+    float f32[3];
+    int i,j,x,y,z;
+    int sites=X*Y*Z;
+    unsigned char *species;
+
+    trajectory.fo=fopen(filename,"wb");
+    fwrite("SNTRAJ01",1,8,trajectory.fo);
+    i32[0]=X; i32[1]=Y; i32[2]=Z; i32[3]=T;
+    i32[4]=DIM; i32[5]=DipoleCutOff; i32[6]=ConstrainToX; i32[7]=TrajectoryInterval;
+    fwrite(i32,sizeof(int32_t),8,trajectory.fo);
+    f64[0]=CageStrain; f64[1]=K;
+    fwrite(f64,sizeof(double),2,trajectory.fo);
+    f32[0]=Efield.x; f32[1]=Efield.y; f32[2]=Efield.z;
+    fwrite(f32,sizeof(float),3,trajectory.fo);
+
+    i32[0]=dipolecount;
+    fwrite(i32,sizeof(int32_t),1,trajectory.fo);
+    for (j=0;j<dipolecount;j++)
+    {
+        f32[0]=dipoles[j].length; f32[1]=dipoles[j].prevalence;
+        fwrite(f32,sizeof(float),2,trajectory.fo);
+    }
+
+    // species of every site; dipoles are never exchanged, so fixed for the run
+    species=(unsigned char *)malloc(sites);
+    for (x=0;x<X;x++)
+        for (y=0;y<Y;y++)
+            for (z=0;z<Z;z++)
+            {
+                i=(x*Y+y)*Z+z;
+                species[i]=255;
+                if (lattice[x][y][z].length==0.0) continue;
+                for (j=0;j<dipolecount;j++)
+                    if (dipoles[j].length==lattice[x][y][z].length) { species[i]=j; break; }
+            }
+    fwrite(species,1,sites,trajectory.fo);
+    free(species);
+
+    trajectory.changed=(unsigned char *)calloc(sites,1);
+    trajectory.changedlist=(int32_t *)malloc(sizeof(int32_t)*sites);
+    trajectory.nchanged=0;
+    trajectory.n=0;
+    trajectory.sincekey=TrajectoryKeyframe; // first frame is a key frame
+    trajectory.sweeps=-1; // MC_moves() samples after its first move, not a sweep
+
+    trajectory_frame(); // initial lattice
+}
+
+// Called from MC_accept()
+static void trajectory_accept(int x, int y, int z)
+{
+    int i=(x*Y+y)*Z+z;
+
+    if (trajectory.changed[i]) return;
+    trajectory.changed[i]=1;
+    trajectory.changedlist[trajectory.nchanged++]=i;
+}
+
+// Called once per sweep from MC_moves()
+static void trajectory_sample()
+{
+    if (trajectory.fo==NULL) return;
+    if (++trajectory.sweeps<TrajectoryInterval) return;
+    trajectory_frame();
+    trajectory.sweeps=0;
+}
+
+static void trajectory_frame()
+{
+    int32_t i32[2];
+    uint64_t moves=ACCEPT+REJECT;
+    float v[3];
+    int i,x,y,z;
+    int sites=X*Y*Z;
+    struct trajectory_index *ix;
+    struct dipole *d;
+
+    if (trajectory.n==trajectory.size) // grow
+    {
+        trajectory.size=trajectory.size ? 2*trajectory.size : 1024;
+        trajectory.index=(struct trajectory_index *)realloc(trajectory.index,sizeof(struct trajectory_index)*trajectory.size);
+    }
+    ix=& trajectory.index[trajectory.n++];
+    ix->offset=ftell(trajectory.fo);
+    ix->moves=moves;
+
+    // key frame if due, or the delta (16 bytes a site) would be no smaller
+    if (!TrajectoryDelta || trajectory.sincekey>=TrajectoryKeyframe-1 || 4*trajectory.nchanged>=3*sites)
+    {
+        ix->type=0; ix->count=sites;
+        trajectory.key=ix->offset;
+        trajectory.sincekey=0;
+    }
+    else
+    {
+        ix->type=1; ix->count=trajectory.nchanged;
+        trajectory.sincekey++;
+    }
+    ix->key=trajectory.key;
+
+    fwrite("FRAM",1,4,trajectory.fo);
+    i32[0]=ix->type;
+    fwrite(i32,sizeof(int32_t),1,trajectory.fo);
+    fwrite(&moves,sizeof(uint64_t),1,trajectory.fo);
+    i32[0]=ix->count;
+    fwrite(i32,sizeof(int32_t),1,trajectory.fo);
+
+    if (ix->type==0)
+    {
+        for (x=0;x<X;x++)
+            for (y=0;y<Y;y++)
+                for (z=0;z<Z;z++)
+                {
+                    v[0]=lattice[x][y][z].x; v[1]=lattice[x][y][z].y; v[2]=lattice[x][y][z].z;
+                    fwrite(v,sizeof(float),3,trajectory.fo);
+                }
+    }
+    else
+        for (i=0;i<trajectory.nchanged;i++)
+        {
+            i32[0]=trajectory.changedlist[i];
+            d=& lattice[i32[0]/(Y*Z)][(i32[0]/Z)%Y][i32[0]%Z];
+            v[0]=d->x; v[1]=d->y; v[2]=d->z;
+            fwrite(i32,sizeof(int32_t),1,trajectory.fo);
+            fwrite(v,sizeof(float),3,trajectory.fo);
+        }
+
+    for (i=0;i<trajectory.nchanged;i++) trajectory.changed[trajectory.changedlist[i]]=0;
+    trajectory.nchanged=0;
+}
+
+// Index and trailer; without these the file is still readable in sequence
+static void trajectory_close()
+{
+    int32_t i32[2];
+    int64_t indexoffset;
+    int i;
+
+    if (trajectory.fo==NULL) return;
+
+    indexoffset=ftell(trajectory.fo);
+    fwrite("INDX",1,4,trajectory.fo);
+    i32[0]=trajectory.n;
+    fwrite(i32,sizeof(int32_t),1,trajectory.fo);
+    for (i=0;i<trajectory.n;i++)
+    {
+        fwrite(&trajectory.index[i].offset,sizeof(int64_t),1,trajectory.fo);
+        fwrite(&trajectory.index[i].key,sizeof(int64_t),1,trajectory.fo);
+        fwrite(&trajectory.index[i].moves,sizeof(uint64_t),1,trajectory.fo);
+        fwrite(&trajectory.index[i].type,sizeof(int32_t),1,trajectory.fo);
+        fwrite(&trajectory.index[i].count,sizeof(int32_t),1,trajectory.fo);
+    }
+    fwrite(&indexoffset,sizeof(int64_t),1,trajectory.fo);
+    fwrite("SNTRAJIX",1,8,trajectory.fo);
+
+    fclose(trajectory.fo);
+    trajectory.fo=NULL;
+}
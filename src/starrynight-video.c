@@ -0,0 +1,153 @@
+/* Starry Night - a Monte Carlo code to simulate ferroelectric domain formation
+ * and behaviour in hybrid perovskite solar cells.
+ *
+ * By Jarvist Moore Frost
+ * University of Bath
+ *
+ * File begun 16th January 2014
+ */
+
+// Video stream: every VideoInterval sweeps, the dipoles of plane VideoSlice
+// (coloured as outputlattice_ppm_hsv()), and with VideoPotential the
+// potential of that plane beside them, each site VideoScale pixels square,
+// written to VideoOutput ("-" for stdout, or a file / named pipe) as
+//  "y4m"  YUV4MPEG2, 4:4:4; e.g. ... | ffmpeg -i - -pix_fmt yuv420p movie.mp4
+//  "rgb"  bare rgb24 frames; ffmpeg -f rawvideo -pix_fmt rgb24 -s WxH -i - ...
+// The frame is rendered into one buffer, allocated once, and written whole.
+// The potential is lattice_potential(): an FFT a frame, unless it is kept
+// current (IncrementalPotential). If the reader goes away, the stream stops;
+// the simulation carries on.
+
+#include <signal.h>
+
+// Prototypes...
+static void video_open();
+static void video_sample();
+static void video_frame();
+static void video_close();
+
+struct
+{
+    FILE *fo;
+    int width,height; // pixels
+    int panel; // width of a panel
+    unsigned char *rgb; // frame
+    unsigned char *yuv; // y4m planes
+    unsigned char *row; // a lattice row, RGB
+    int sweeps; // since the last frame
+    unsigned long frames;
+} video={NULL};
+
+static void video_open()
+{
+    int scale=VideoScale>1 ? VideoScale : 1;
+
+    video.panel=Y*scale;
+    video.width=VideoPotential ? 2*video.panel : video.panel;
+    video.height=X*scale;
+    if (VideoSlice<0 || VideoSlice>=Z) VideoSlice=0;
+
+    if (strcmp(VideoOutput,"-")==0)
+        video.fo=stdout;
+    else
+    {
+        fprintf(stderr,"Video: opening %s (a named pipe waits here for its reader)...\n",VideoOutput);
+        video.fo=fopen(VideoOutput,"wb");
+    }
+    if (video.fo==NULL)
+    {
+        fprintf(stderr,"Video: can't open %s; no video.\n",VideoOutput);
+        return;
+    }
+    signal(SIGPIPE,SIG_IGN); // a reader quitting is a write error, not our end
+
+    video.rgb=(unsigned char *)malloc(3*video.width*video.height);
+    video.yuv=(unsigned char *)malloc(3*video.width*video.height);
+    video.row=(unsigned char *)malloc(3*Y);
+    video.frames=0;
+    video.sweeps=-1; // MC_moves() samples after its first move, not a sweep
+
+    if (strcmp(VideoFormat,"rgb")==0)
+        fprintf(stderr,"Video: rgb24 %dx%d; read with: ffmpeg -f rawvideo -pix_fmt rgb24 -s %dx%d -r %d -i %s ...\n",
+                video.width,video.height,video.width,video.height,VideoFPS,VideoOutput);
+    else
+    {
+        fprintf(video.fo,"YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C444\n",video.width,video.height,VideoFPS);
+        fprintf(stderr,"Video: y4m %dx%d; read with: ffmpeg -i %s ...\n",video.width,video.height,VideoOutput);
+    }
+
+    video_frame(); // initial lattice
+}
+
+// Called once per sweep from MC_moves()
+static void video_sample()
+{
+    if (video.fo==NULL) return;
+    if (++video.sweeps<VideoInterval) return;
+    video_frame();
+    video.sweeps=0;
+}
+
+static void video_frame()
+{
+    int scale=VideoScale>1 ? VideoScale : 1;
+    int pixels=video.width*video.height;
+    int x,y,i,c,grey;
+    unsigned char *line,*px,r,g,b;
+    double *phi=VideoPotential ? lattice_potential() : NULL;
+    size_t size;
+
+    // first row of pixels of each lattice row; then repeated down
+    for (x=0;x<X;x++)
+    {
+        line=video.rgb+3*(size_t)video.width*x*scale;
+        lattice_hsv_row(video.row,x,VideoSlice);
+        for (y=0;y<Y;y++)
+            for (i=0;i<scale;i++)
+                memcpy(line+3*(y*scale+i),video.row+3*y,3);
+        if (VideoPotential)
+            for (y=0;y<Y;y++)
+            {
+                grey=potential_pixel(phi,x,y,VideoSlice)>>7; // 0..SHRT_MAX -> 0..255
+                for (i=0;i<scale;i++)
+                    memset(line+3*(video.panel+y*scale+i),grey,3);
+            }
+        for (i=1;i<scale;i++)
+            memcpy(line+3*(size_t)video.width*i,line,3*video.width);
+    }
+
+    if (strcmp(VideoFormat,"rgb")==0)
+    {
+        px=video.rgb;
+        size=3*(size_t)pixels;
+    }
+    else // BT.601, studio range, as y4m is read by default
+    {
+        for (c=0;c<pixels;c++)
+        {
+            r=video.rgb[3*c]; g=video.rgb[3*c+1]; b=video.rgb[3*c+2];
+            video.yuv[c]=((66*r+129*g+25*b+128)>>8)+16;
+            video.yuv[pixels+c]=((-38*r-74*g+112*b+128)>>8)+128;
+            video.yuv[2*pixels+c]=((112*r-94*g-18*b+128)>>8)+128;
+        }
+        fputs("FRAME\n",video.fo);
+        px=video.yuv;
+        size=3*(size_t)pixels;
+    }
+
+    if (fwrite(px,1,size,video.fo)!=size || fflush(video.fo)!=0)
+    {
+        fprintf(stderr,"Video: write failed (reader gone?) after %lu frames; stopping video.\n",video.frames);
+        video_close();
+        return;
+    }
+    video.frames++;
+}
+
+static void video_close()
+{
+    if (video.fo==NULL) return;
+    if (video.fo!=stdout) fclose(video.fo);
+    video.fo=NULL;
+    free(video.rgb); free(video.yuv); free(video.row);
+}
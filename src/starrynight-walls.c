@@ -0,0 +1,145 @@
+/* Starry Night - a Monte Carlo code to simulate ferroelectric domain formation
+ * and behaviour in hybrid perovskite solar cells.
+ *
+ * By Jarvist Moore Frost
+ * University of Bath
+ *
+ * File begun 16th January 2014
+ */
+
+// Domain wall tracking, for wall creep from the *_wall initialisers. A wall
+// is any nearest neighbour bond (periodic) whose dipoles have dot product
+// below WallThreshold; with WallAntiparallel, |dot| is used instead, so
+// antiferroelectric order (antiparallel neighbours) counts as one domain.
+//
+// The wall set is held as running totals (count, first and second moments of
+// position along x), seeded once by lattice_walls() and then updated by
+// walls_accept() from the six bonds of each accepted move; so O(1) per move
+// and per sample, and logged every sweep.
+//
+// Positions are measured along x from WallOrigin, modulo X: x+1/2 for a bond
+// along x, x for bonds along y and z. Put the origin in a region without
+// walls, or the mean jumps as a wall crosses it.
+
+// Prototypes...
+static int wall_bond(struct dipole *a, struct dipole *b);
+static double wall_position(double x);
+static void wall_add(double x, int sign);
+static void lattice_walls();
+static void walls_accept(int x, int y, int z, struct dipole *newdipole);
+static void walls_sample();
+static void walls_check(FILE *log);
+
+struct
+{
+    long count; // wall bonds; area in units of the lattice face
+    double sum, sum2; // of position along x
+} walls;
+FILE *wallslog=NULL; // per sweep time series, opened in main
+double wall_lastmean=0.0; // for the velocity
+unsigned long wall_lastmoves=0;
+
+static int wall_bond(struct dipole *a, struct dipole *b)
+{
+    float d;
+
+    if (a->length==0.0 || b->length==0.0) return(false); // no dipole, no wall
+    d=dot(a,b);
+    if (WallAntiparallel) d=fabs(d);
+    return(d<WallThreshold);
+}
+
+static double wall_position(double x)
+{
+    return(fmod(x-WallOrigin+2*X,(double)X));
+}
+
+// Add (sign=1) or remove (sign=-1) a wall bond at position x
+static void wall_add(double x, int sign)
+{
+    x=wall_position(x);
+    walls.count+=sign;
+    walls.sum+=sign*x;
+    walls.sum2+=sign*x*x;
+}
+
+// Full count; seeds the running totals
+static void lattice_walls()
+{
+    int x,y,z;
+    struct dipole *p;
+
+    walls.count=0; walls.sum=0.0; walls.sum2=0.0;
+    for (x=0;x<X;x++)
+        for (y=0;y<Y;y++)
+            for (z=0;z<Z;z++)
+            {
+                p=& lattice[x][y][z];
+                if (X>1 && wall_bond(p,&lattice[(x+1)%X][y][z])) wall_add(x+0.5,1);
+                if (Y>1 && wall_bond(p,&lattice[x][(y+1)%Y][z])) wall_add(x,1);
+                if (Z>1 && wall_bond(p,&lattice[x][y][(z+1)%Z])) wall_add(x,1);
+            }
+}
+
+// Called from MC_accept() before the lattice is updated
+static void walls_accept(int x, int y, int z, struct dipole *newdipole)
+{
+    struct dipole *old=& lattice[x][y][z], *n;
+    int xm=(X+x-1)%X, xp=(x+1)%X;
+    int i,before,after;
+    double pos;
+
+    for (i=0;i<6;i++)
+    {
+        switch (i)
+        {
+            case 0: if (X<2) continue; n=& lattice[xp][y][z]; pos=x+0.5; break;
+            case 1: if (X<2) continue; n=& lattice[xm][y][z]; pos=xm+0.5; break;
+            case 2: if (Y<2) continue; n=& lattice[x][(y+1)%Y][z]; pos=x; break;
+            case 3: if (Y<2) continue; n=& lattice[x][(Y+y-1)%Y][z]; pos=x; break;
+            case 4: if (Z<2) continue; n=& lattice[x][y][(z+1)%Z]; pos=x; break;
+            default: if (Z<2) continue; n=& lattice[x][y][(Z+z-1)%Z]; pos=x; break;
+        }
+        before=wall_bond(old,n);
+        after=wall_bond(newdipole,n);
+        if (before!=after) wall_add(pos,after ? 1 : -1);
+    }
+}
+
+// Once per sweep: moves, wall area, area per Y*Z cross section (i.e. number
+// of walls spanning the cell), mean position, rms spread and velocity (lattice
+// units per sweep) of the mean
+static void walls_sample()
+{
+    int sites=X*Y*Z;
+    unsigned long moves=ACCEPT+REJECT;
+    double mean=0.0, rms=0.0, velocity=0.0;
+
+    if (wallslog==NULL) return;
+
+    if (walls.count>0)
+    {
+        mean=walls.sum/walls.count;
+        rms=walls.sum2/walls.count-mean*mean;
+        rms=rms>0.0 ? sqrt(rms) : 0.0;
+    }
+    if (wall_lastmoves>0 && moves>wall_lastmoves) // none for the first sample
+        velocity=(mean-wall_lastmean)/((double)(moves-wall_lastmoves)/sites);
+
+    fprintf(wallslog,"%lu %ld %f %f %f %f\n",moves,walls.count,(double)walls.count/(Y*Z),mean,rms,velocity);
+
+    wall_lastmean=mean;
+    wall_lastmoves=moves;
+}
+
+// Drift of the running wall set vs. a full count (which then replaces it)
+static void walls_check(FILE *log)
+{
+    long count=walls.count;
+    double sum=walls.sum;
+
+    lattice_walls();
+    fprintf(stderr,"Walls check: count drift %ld position sum drift %e\n",count-walls.count,sum-walls.sum);
+    fprintf(log,"# Walls check: moves %lu count drift %ld position sum drift %e\n",
+            ACCEPT+REJECT,count-walls.count,sum-walls.sum);
+}
@@ -0,0 +1,253 @@
+/* Starry Night - a Monte Carlo code to simulate ferroelectric domain formation
+ * and behaviour in hybrid perovskite solar cells.
+ *
+ * By Jarvist Moore Frost
+ * University of Bath
+ *
+ * File begun 16th January 2014
+ */
+
+// Wang-Landau estimate of the density of states g(E), followed by a
+// multicanonical production run which samples observables per energy bin.
+// Canonical averages at any T then follow by reweighting, so one run replaces
+// a whole 'seq 0 10 1000 | parallel ./starrynight {}' temperature scan.
+//
+// Wang & Landau, PRL 86 2050 (2001); Berg & Neuhaus, PRL 68 9 (1992).
+
+// Prototypes...
+static void wang_landau(FILE *logfile);
+static void wl_probe_range();
+static int wl_bin(double E);
+static void wl_move(double *lng, double lnf, unsigned long *H);
+static int wl_flat(unsigned long *H, int *visited);
+static void wl_canonical(char * filename, double *lng, double *nsample, double *Psum, double *Lsum);
+
+double wl_Emin, wl_Ewidth; // energy axis actually in use; bins of width wl_Ewidth
+
+static int wl_bin(double E)
+{
+    int bin=(int)floor((E-wl_Emin)/wl_Ewidth);
+    if (bin<0 || bin>=WangLandauBins) return(-1); // outside window
+    return(bin);
+}
+
+// Find an energy window when one isn't given in the config. The infinite
+// temperature (beta=0) walk gives the top of the range (nothing above it
+// matters for T>0); a quick anneal gives an estimate of the bottom. Bare
+// MC_move()s, not MC_moves(): these throwaway sweeps must not reach the
+// per-sweep samplers (moments, trajectory, video...).
+static void wl_probe_range()
+{
+    int i,j;
+    int sites=X*Y*Z;
+    double Emax=Etotal, Emin=Etotal;
+    double savebeta=beta;
+
+    beta=0.0;
+    for (i=0;i<10;i++)
+    {
+        for (j=0;j<sites;j++) MC_move();
+        if (Etotal>Emax) Emax=Etotal;
+    }
+    for (beta=0.1;beta<100.0;beta*=1.2) // geometric anneal
+    {
+        for (j=0;j<sites;j++) MC_move();
+        if (Etotal<Emin) Emin=Etotal;
+    }
+    beta=savebeta;
+
+    WangLandauEmin=Emin-0.05*(Emax-Emin); // margin; the anneal won't find the true ground state
+    WangLandauEmax=Emax;
+    fprintf(stderr,"Wang-Landau energy window probed: Emin= %f Emax= %f\n",WangLandauEmin,WangLandauEmax);
+}
+
+// As MC_move(), but accepting with min(1,g(E)/g(E')) rather than the
+// Boltzmann factor. Whilst outside the window we only accept moves which take
+// us towards it, so a window can be entered from any starting lattice.
+static void wl_move(double *lng, double lnf, unsigned long *H)
+{
+    int x,y,z;
+    int oldbin,newbin;
+    double dE;
+    struct dipole newdipole;
+
+    if (!MC_trial(&x,&y,&z, & newdipole)) return;
+
+    dE=site_energy(x,y,z, & newdipole, & lattice[x][y][z]);
+
+    oldbin=wl_bin(Etotal);
+    newbin=wl_bin(Etotal+dE);
+
+    if (oldbin<0)
+    {
+        if ( newbin>=0 || (Etotal<wl_Emin ? dE>0.0 : dE<0.0) )
+            MC_accept(x,y,z, & newdipole, dE);
+        else
+            REJECT++;
+    }
+    else if (newbin>=0 && (lng[newbin]<=lng[oldbin] || exp(lng[oldbin]-lng[newbin]) > genrand_real2()) )
+        MC_accept(x,y,z, & newdipole, dE);
+    else
+        REJECT++;
+
+    // update g(E), H(E) of wherever we ended up
+    oldbin=wl_bin(Etotal);
+    if (oldbin>=0)
+    {
+        lng[oldbin]+=lnf;
+        H[oldbin]++;
+    }
+}
+
+// Histogram flat if every bin visited so far has H > WangLandauFlatness * <H>
+static int wl_flat(unsigned long *H, int *visited)
+{
+    int i,nvisited=0;
+    double mean=0.0;
+    unsigned long min=ULONG_MAX;
+
+    for (i=0;i<WangLandauBins;i++)
+    {
+        if (H[i]>0) visited[i]=true;
+        if (!visited[i]) continue;
+        nvisited++;
+        mean+=H[i];
+        if (H[i]<min) min=H[i];
+    }
+    if (nvisited<2) return(false);
+    mean/=nvisited;
+
+    return((double)min > WangLandauFlatness*mean);
+}
+
+static void wang_landau(FILE *logfile)
+{
+    int i,bin,sweep;
+    double lnf=1.0;
+    double *lng, *nsample, *Psum, *Lsum;
+    unsigned long *H;
+    int *visited;
+    int sites=X*Y*Z;
+
+    if (WangLandauEmin>=WangLandauEmax) wl_probe_range();
+    if (WangLandauEmin>=WangLandauEmax)
+    {
+        fprintf(stderr,"Wang-Landau: empty energy window [%f,%f] (no mobile dipoles?). FAILING TO EXIT!\n\n",
+                WangLandauEmin,WangLandauEmax);
+        exit(-1);
+    }
+    wl_Emin=WangLandauEmin;
+    wl_Ewidth=(WangLandauEmax-WangLandauEmin)/(double)WangLandauBins;
+
+    lng=(double *)calloc(WangLandauBins,sizeof(double));
+    nsample=(double *)calloc(WangLandauBins,sizeof(double));
+    Psum=(double *)calloc(WangLandauBins,sizeof(double));
+    Lsum=(double *)calloc(WangLandauBins,sizeof(double));
+    H=(unsigned long *)calloc(WangLandauBins,sizeof(unsigned long));
+    visited=(int *)calloc(WangLandauBins,sizeof(int));
+
+    fprintf(stderr,"Wang-Landau: %d bins of width %f on [%f,%f]; flatness %f; final ln(f) %e\n",
+            WangLandauBins,wl_Ewidth,WangLandauEmin,WangLandauEmax,WangLandauFlatness,WangLandauFinalLnF);
+    fprintf(logfile,"# Wang-Landau: %d bins of width %f on [%f,%f]\n",
+            WangLandauBins,wl_Ewidth,WangLandauEmin,WangLandauEmax);
+
+    // Wang-Landau iterations; ln(f) halves each time the histogram goes flat
+    // (i.e. f -> sqrt(f))
+    for (sweep=0; lnf>WangLandauFinalLnF; sweep++)
+    {
+        for (i=0;i<sites;i++)
+            wl_move(lng,lnf,H);
+
+        if (sweep%100==99 && wl_flat(H,visited))
+        {
+            fprintf(stderr,"Wang-Landau: flat after %d sweeps at ln(f)= %e\n",sweep+1,lnf);
+            fprintf(logfile,"# Wang-Landau: flat after %d sweeps at ln(f)= %e\n",sweep+1,lnf);
+            for (i=0;i<WangLandauBins;i++) H[i]=0;
+            lnf/=2.0;
+        }
+    }
+
+    // Multicanonical production: weights frozen at 1/g(E); sample the
+    // observables once per sweep into their energy bins.
+    for (i=0;i<WangLandauBins;i++) H[i]=0;
+    fprintf(stderr,"Multicanonical production: %d sweeps...\n",MulticanonicalSweeps);
+    for (sweep=0;sweep<MulticanonicalSweeps;sweep++)
+    {
+        for (i=0;i<sites;i++)
+            wl_move(lng,0.0,H);
+
+        bin=wl_bin(Etotal);
+        if (bin<0) continue;
+        nsample[bin]+=1.0;
+        Psum[bin]+=polarisation_running();
+        Lsum[bin]+=landau_order_running();
+    }
+
+    // Multicanonical correction: any residual non-flatness of the production
+    // histogram is itself the error in ln g(E)
+    for (i=0;i<WangLandauBins;i++)
+        if (H[i]>0) lng[i]+=log((double)H[i]);
+
+    wl_canonical("WangLandau_canonical.dat",lng,nsample,Psum,Lsum);
+
+    FILE *fo;
+    fo=fopen("WangLandau_dos.dat","w");
+    fprintf(fo,"# E ln(g(E)) samples <P>_E <Landau>_E\n");
+    for (i=0;i<WangLandauBins;i++)
+    {
+        if (H[i]==0) continue; // never visited in production
+        fprintf(fo,"%f %f %.0f %f %f\n",wl_Emin+(i+0.5)*wl_Ewidth,lng[i],nsample[i],
+                nsample[i]>0 ? Psum[i]/nsample[i] : 0.0,
+                nsample[i]>0 ? Lsum[i]/nsample[i] : 0.0);
+    }
+    fclose(fo);
+
+    free(lng); free(nsample); free(Psum); free(Lsum); free(H); free(visited);
+}
+
+// Reweight g(E) and the microcanonical <P>_E, <Landau>_E to canonical
+// averages over a temperature grid. Exponents are shifted by their maximum
+// (log-sum-exp) as ln g(E) runs to many hundreds.
+static void wl_canonical(char * filename, double *lng, double *nsample, double *Psum, double *Lsum)
+{
+    int i,t;
+    double b,E,lnw,lnwmax;
+    double partition,Eavg,E2avg,Pavg,Lavg,w;
+    int sites=X*Y*Z;
+
+    FILE *fo;
+    fo=fopen(filename,"w");
+    fprintf(fo,"# T <E> C_v(per site) <P> <Landau>\n");
+
+    for (t=WangLandauTmin;t<=WangLandauTmax;t+=WangLandauTstep)
+    {
+        if (t<=0) continue; // beta infinite
+        b=1/((float)t/300.0); // as beta in main()
+
+        lnwmax=-INFINITY;
+        for (i=0;i<WangLandauBins;i++)
+        {
+            if (nsample[i]==0.0) continue;
+            lnw=lng[i]-b*(wl_Emin+(i+0.5)*wl_Ewidth);
+            if (lnw>lnwmax) lnwmax=lnw;
+        }
+
+        partition=0.0; Eavg=0.0; E2avg=0.0; Pavg=0.0; Lavg=0.0;
+        for (i=0;i<WangLandauBins;i++)
+        {
+            if (nsample[i]==0.0) continue;
+            E=wl_Emin+(i+0.5)*wl_Ewidth;
+            w=exp(lng[i]-b*E-lnwmax);
+            partition+=w;
+            Eavg+=w*E;
+            E2avg+=w*E*E;
+            Pavg+=w*Psum[i]/nsample[i];
+            Lavg+=w*Lsum[i]/nsample[i];
+        }
+        if (partition==0.0) continue;
+        Eavg/=partition; E2avg/=partition; Pavg/=partition; Lavg/=partition;
+
+        fprintf(fo,"%d %f %f %f %f\n",t,Eavg,b*b*(E2avg-Eavg*Eavg)/(double)sites,Pavg,Lavg);
+    }
+    fclose(fo);
+}
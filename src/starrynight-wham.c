@@ -0,0 +1,321 @@
+/* Starry Night - a Monte Carlo code to simulate ferroelectric domain formation
+ * and behaviour in hybrid perovskite solar cells.
+ *
+ * By Jarvist Moore Frost
+ * University of Bath
+ *
+ * File begun 16th January 2014
+ */
+
+// starrynight-wham - Ferrenberg-Swendsen multiple histogram reweighting of
+// the Samples_T_xxxx.dat streams written with SaveSamples: true.
+//
+// A handful of runs at different T are combined into continuous curves of
+// <E>, C_v, <P>, <|P|> and <Landau> on any temperature grid, with jackknife
+// error bars. This is the bin-free form of WHAM (each sample is its own
+// histogram bin; Shirts & Chodera's MBAR), so there's no energy bin width to
+// choose.
+//
+// Ferrenberg & Swendsen, PRL 63 1195 (1989).
+//
+// Usage: ./starrynight-wham [-T Tmin:Tstep:Tmax] [-b blocks] Samples_T_*.dat > reweighted.dat
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+enum {MAXRUNS=256, NOBS=5};
+
+struct run {
+    int T;
+    double beta;
+    int N; // lattice sites
+    double CageStrain;
+    int n; // samples
+    int offset; // of this run's samples in the packed arrays, and lnD[]
+    double *E, *P, *L;
+} runs[MAXRUNS];
+int nruns=0;
+
+double *lnD; // per-sample log denominator, sum_k N_k exp(f_k - beta_k E)
+
+// Prototypes...
+static void read_samples(char * filename);
+static void wham(int block, int nblocks, double *f);
+static void reweight(double beta, int block, int nblocks, double *obs);
+static int in_block(int k, int s, int block, int nblocks);
+
+static void read_samples(char * filename)
+{
+    char line[1000];
+    struct run *r=&runs[nruns];
+    int size=1000;
+    unsigned long long moves;
+    double E,P,L;
+
+    FILE *fi;
+    fi=fopen(filename,"r");
+    if (fi==NULL)
+    {
+        fprintf(stderr,"Can't open %s. FAILING TO EXIT!\n\n",filename);
+        exit(-1);
+    }
+
+    r->T=0; r->N=1; r->n=0; r->CageStrain=0.0;
+    r->E=(double *)malloc(sizeof(double)*size);
+    r->P=(double *)malloc(sizeof(double)*size);
+    r->L=(double *)malloc(sizeof(double)*size);
+
+    while (fgets(line,sizeof(line),fi))
+    {
+        if (line[0]=='#')
+        {
+            sscanf(line,"# Samples T: %d N: %d CageStrain: %lf",&r->T,&r->N,&r->CageStrain);
+            continue;
+        }
+        if (sscanf(line,"%llu %lf %lf %lf",&moves,&E,&P,&L)!=4) continue;
+
+        if (r->n==size) // grow
+        {
+            size*=2;
+            r->E=(double *)realloc(r->E,sizeof(double)*size);
+            r->P=(double *)realloc(r->P,sizeof(double)*size);
+            r->L=(double *)realloc(r->L,sizeof(double)*size);
+        }
+        r->E[r->n]=E; r->P[r->n]=P; r->L[r->n]=L;
+        r->n++;
+    }
+    fclose(fi);
+
+    if (r->T<=0 || r->n==0)
+    {
+        fprintf(stderr,"Skipping %s (T: %d samples: %d)\n",filename,r->T,r->n);
+        return;
+    }
+    // Reweighting combines runs of the one Hamiltonian; C_v is per site
+    if (nruns>0 && (r->N!=runs[0].N || r->CageStrain!=runs[0].CageStrain))
+    {
+        fprintf(stderr,"%s: N: %d CageStrain: %f, but %d runs so far have N: %d CageStrain: %f. FAILING TO EXIT!\n\n",
+                filename,r->N,r->CageStrain,nruns,runs[0].N,runs[0].CageStrain);
+        exit(-1);
+    }
+    r->beta=1/((float)r->T/300.0); // as beta in starrynight main()
+    fprintf(stderr,"Read %s: T: %d N: %d samples: %d\n",filename,r->T,r->N,r->n);
+    nruns++;
+}
+
+// Jackknife: each run is cut into nblocks contiguous blocks, and block 'block'
+// is left out of every run. block<0 --> use everything.
+static int in_block(int k, int s, int block, int nblocks)
+{
+    if (block<0) return(1);
+    return( (s*nblocks)/runs[k].n != block );
+}
+
+// Iterate the WHAM equations to self-consistency for the dimensionless free
+// energies f[k]:
+//   exp(-f_l) = sum_samples exp(-beta_l E) / sum_k N_k exp(f_k - beta_k E)
+// Everything is kept as logarithms (log-sum-exp), as beta*E is large.
+static void wham(int block, int nblocks, double *f)
+{
+    int k,l,s,iter;
+    double max,sum,change,lnN[MAXRUNS],fnew[MAXRUNS];
+    double x;
+
+    for (k=0;k<nruns;k++)
+    {
+        lnN[k]=0.0;
+        for (s=0;s<runs[k].n;s++) lnN[k]+=in_block(k,s,block,nblocks);
+        lnN[k]=log(lnN[k]);
+    }
+
+    for (iter=0;iter<10000;iter++)
+    {
+        // denominators
+        for (l=0;l<nruns;l++)
+            for (s=0;s<runs[l].n;s++)
+            {
+                max=-INFINITY;
+                for (k=0;k<nruns;k++)
+                {
+                    x=lnN[k]+f[k]-runs[k].beta*runs[l].E[s];
+                    if (x>max) max=x;
+                }
+                sum=0.0;
+                for (k=0;k<nruns;k++)
+                    sum+=exp(lnN[k]+f[k]-runs[k].beta*runs[l].E[s]-max);
+                lnD[runs[l].offset+s]=max+log(sum);
+            }
+
+        // new free energies
+        for (k=0;k<nruns;k++)
+        {
+            max=-INFINITY;
+            for (l=0;l<nruns;l++)
+                for (s=0;s<runs[l].n;s++)
+                {
+                    if (!in_block(l,s,block,nblocks)) continue;
+                    x=-runs[k].beta*runs[l].E[s]-lnD[runs[l].offset+s];
+                    if (x>max) max=x;
+                }
+            sum=0.0;
+            for (l=0;l<nruns;l++)
+                for (s=0;s<runs[l].n;s++)
+                {
+                    if (!in_block(l,s,block,nblocks)) continue;
+                    sum+=exp(-runs[k].beta*runs[l].E[s]-lnD[runs[l].offset+s]-max);
+                }
+            fnew[k]=-(max+log(sum));
+        }
+
+        change=0.0;
+        for (k=0;k<nruns;k++)
+        {
+            fnew[k]-=fnew[0]; // fix gauge
+            if (fabs(fnew[k]-f[k])>change) change=fabs(fnew[k]-f[k]);
+            f[k]=fnew[k];
+        }
+        if (change<1e-7) break;
+    }
+}
+
+// Canonical averages at inverse temperature beta from the converged lnD[]
+// obs[] = { <E>, C_v per site, <P>, <|P|>, <Landau> }
+static void reweight(double beta, int block, int nblocks, double *obs)
+{
+    int l,s;
+    double x,max=-INFINITY,w,Z=0.0;
+    double E=0.0,E2=0.0,P=0.0,absP=0.0,L=0.0;
+
+    for (l=0;l<nruns;l++)
+        for (s=0;s<runs[l].n;s++)
+        {
+            if (!in_block(l,s,block,nblocks)) continue;
+            x=-beta*runs[l].E[s]-lnD[runs[l].offset+s];
+            if (x>max) max=x;
+        }
+
+    for (l=0;l<nruns;l++)
+        for (s=0;s<runs[l].n;s++)
+        {
+            if (!in_block(l,s,block,nblocks)) continue;
+            w=exp(-beta*runs[l].E[s]-lnD[runs[l].offset+s]-max);
+            Z+=w;
+            E+=w*runs[l].E[s];
+            E2+=w*runs[l].E[s]*runs[l].E[s];
+            P+=w*runs[l].P[s];
+            absP+=w*fabs(runs[l].P[s]);
+            L+=w*runs[l].L[s];
+        }
+    E/=Z; E2/=Z; P/=Z; absP/=Z; L/=Z;
+
+    obs[0]=E;
+    obs[1]=beta*beta*(E2-E*E)/(double)runs[0].N;
+    obs[2]=P;
+    obs[3]=absP;
+    obs[4]=L;
+}
+
+static void usage(char *name)
+{
+    fprintf(stderr,"Usage: %s [-T Tmin:Tstep:Tmax] [-b blocks] Samples_T_*.dat > reweighted.dat\n",name);
+    exit(-1);
+}
+
+int main(int argc, char *argv[])
+{
+    int i,k,b,t;
+    int Tmin=10, Tstep=10, Tmax=1000;
+    int nblocks=10;
+    int total=0;
+    double *E, *P, *L;
+    double f[MAXRUNS], fjack[MAXRUNS];
+    double obs[NOBS], jack[NOBS], jackmean[NOBS], jackvar[NOBS];
+    double *jackobs;
+    double beta;
+
+    for (i=1;i<argc;i++)
+    {
+        if (strcmp(argv[i],"-T")==0 && i+1<argc)
+        {
+            if (sscanf(argv[++i],"%d:%d:%d",&Tmin,&Tstep,&Tmax)!=3 || Tstep<=0 || Tmax<Tmin)
+                usage(argv[0]);
+            continue;
+        }
+        if (strcmp(argv[i],"-b")==0 && i+1<argc)
+        {
+            if (sscanf(argv[++i],"%d",&nblocks)!=1) usage(argv[0]);
+            continue;
+        }
+        if (nruns==MAXRUNS)
+        {
+            fprintf(stderr,"More than %d runs. FAILING TO EXIT!\n\n",MAXRUNS);
+            exit(-1);
+        }
+        read_samples(argv[i]);
+    }
+    if (nruns==0) usage(argv[0]);
+    if (nblocks<2) nblocks=2;
+
+    // Pack all samples contiguously, so one index addresses lnD[]
+    for (k=0;k<nruns;k++) total+=runs[k].n;
+    E=(double *)malloc(sizeof(double)*total);
+    P=(double *)malloc(sizeof(double)*total);
+    L=(double *)malloc(sizeof(double)*total);
+    lnD=(double *)malloc(sizeof(double)*total);
+    for (i=0,k=0;k<nruns;k++)
+    {
+        runs[k].offset=i;
+        memcpy(E+i,runs[k].E,sizeof(double)*runs[k].n); free(runs[k].E); runs[k].E=E+i;
+        memcpy(P+i,runs[k].P,sizeof(double)*runs[k].n); free(runs[k].P); runs[k].P=P+i;
+        memcpy(L+i,runs[k].L,sizeof(double)*runs[k].n); free(runs[k].L); runs[k].L=L+i;
+        i+=runs[k].n;
+    }
+
+    // Jackknife estimates for every T on the grid; [block][T][obs]
+    int nT=(Tmax-Tmin)/Tstep+1;
+    jackobs=(double *)malloc(sizeof(double)*nblocks*nT*NOBS);
+
+    for (b=0;b<nblocks;b++)
+    {
+        for (k=0;k<nruns;k++) fjack[k]=0.0;
+        wham(b,nblocks,fjack);
+        for (i=0,t=Tmin;t<=Tmax;t+=Tstep,i++)
+        {
+            if (t<=0) continue;
+            reweight(1/((float)t/300.0),b,nblocks,&jackobs[(b*nT+i)*NOBS]);
+        }
+    }
+
+    // Full data set last, so lnD[] is left consistent with f[]
+    for (k=0;k<nruns;k++) f[k]=0.0;
+    wham(-1,nblocks,f);
+
+    printf("# starrynight-wham: %d runs, %d samples, %d jackknife blocks\n",nruns,total,nblocks);
+    for (k=0;k<nruns;k++)
+        printf("# run %d T: %d samples: %d f: %f\n",k,runs[k].T,runs[k].n,f[k]);
+    printf("# T <E> d<E> C_v dC_v <P> d<P> <|P|> d<|P|> <Landau> d<Landau>\n");
+
+    for (i=0,t=Tmin;t<=Tmax;t+=Tstep,i++)
+    {
+        if (t<=0) continue; // beta infinite
+        beta=1/((float)t/300.0);
+        reweight(beta,-1,nblocks,obs);
+
+        for (k=0;k<NOBS;k++)
+        {
+            jackmean[k]=0.0; jackvar[k]=0.0;
+            for (b=0;b<nblocks;b++) jackmean[k]+=jackobs[(b*nT+i)*NOBS+k]/nblocks;
+            for (b=0;b<nblocks;b++)
+                jackvar[k]+=(jackobs[(b*nT+i)*NOBS+k]-jackmean[k])*(jackobs[(b*nT+i)*NOBS+k]-jackmean[k]);
+            jack[k]=sqrt(jackvar[k]*(nblocks-1)/(double)nblocks);
+        }
+
+        printf("%d",t);
+        for (k=0;k<NOBS;k++) printf(" %g %g",obs[k],jack[k]);
+        printf("\n");
+    }
+
+    return 0;
+}